@@ -3,14 +3,16 @@ tcp_client.c: the source file of the client in tcp transmission for a large pack
 ********************************/
 
 #include "headsock.h"
+#include "timing.h"
 
-float str_cli(FILE *fp, int sockfd, long *len);                       //packet transmission fuction
-void tv_sub(struct  timeval *out, struct timeval *in);	    //calcu the time interval between out and in
+double str_cli(FILE *fp, int sockfd, long *len);                      //packet transmission fuction
+
+struct timing_so timing;	// time spent in each phase of the transfer
 
 int main(int argc, char **argv)
 {
 	int sockfd, ret;
-	float ti, rt;
+	double ti, rt;
 	long len;
 	struct sockaddr_in ser_addr;
 	char ** pptr;
@@ -18,6 +20,7 @@ int main(int argc, char **argv)
 	struct in_addr **addrs;
 	FILE *fp;
 
+	timing_init(&timing);
 	if (argc != 2) {
 		printf("parameters not match");
 	}
@@ -66,25 +69,24 @@ int main(int argc, char **argv)
 	}
 
 	ti = str_cli(fp, sockfd, &len);                       //perform the transmission and receiving
+	close(sockfd);
+	fclose(fp);
+	timing_phase(&timing, -1);
 	if (ti != -1)	{
-		rt = (len/(float)ti);                                         //caculate the average transmission rate
+		rt = len / ti;                                                //caculate the average transmission rate
 		printf("Ave Time(ms) : %.3f, Ave Data sent(byte): %d\nAve Data rate: %f (Kbytes/s)\n", ti, (int)len, rt);
+		timing_print(&timing);
 	}
-
-	close(sockfd);
-	fclose(fp);
 //}
 	exit(0);
 }
 
-float str_cli(FILE *fp, int sockfd, long *len)
+double str_cli(FILE *fp, int sockfd, long *len)
 {
 	long lsize;
 	struct pack_so sends;
 	struct ack_so acks;
 	int n;
-	float time_inv = 0.0;
-	struct timeval sendt, recvt;
 
 	fseek (fp , 0 , SEEK_END);
 	*len= lsize = ftell (fp);
@@ -93,11 +95,12 @@ float str_cli(FILE *fp, int sockfd, long *len)
 	
 
   // copy the file into the buffer.
+	timing_phase(&timing, PH_LOAD);
 	fread (sends.data,1,lsize,fp);					//read the file data into the data area in packet
 
   /*** the whole file is loaded in the buffer. ***/
 
-	gettimeofday(&sendt, NULL);							//get the current time
+	timing_phase(&timing, PH_FIRST);					//the transfer starts
 
 	sends.len = lsize;									//the data length
 	sends.num = 0;
@@ -107,16 +110,16 @@ float str_cli(FILE *fp, int sockfd, long *len)
 		exit(1);
 	}
 	else printf("%d data sent", n);
+	timing_sent(&timing);								//the one send carried the whole file
+	timing_phase(&timing, PH_ACK_WAIT);
 	if ((n=recv(sockfd, &acks, 2, 0)) == -1) {	        //receive ACK or NACK
 		printf("error receiving data\n");
 		exit(1);
 	}
 	if ((acks.len == 0) && (acks.num == 1))         //if it is ACK
 	{
-		gettimeofday(&recvt, NULL);                                                         //get current time
-		tv_sub(&recvt, &sendt);                                                                 // get the whole trans time
-		time_inv += (recvt.tv_sec)*1000.0 + (recvt.tv_usec)/1000.0;
-		return(time_inv);
+		timing_phase(&timing, PH_TEARDOWN);
+		return timing_transfer_ms(&timing);
 	}
 	else	{
 		return(-1);
@@ -124,12 +127,3 @@ float str_cli(FILE *fp, int sockfd, long *len)
 	}
 }
 
-void tv_sub(struct  timeval *out, struct timeval *in)
-{
-	if ((out->tv_usec -= in->tv_usec) <0)
-	{
-		--out ->tv_sec;
-		out ->tv_usec += 1000000;
-	}
-	out->tv_sec -= in->tv_sec;
-}
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""
+Compare the tcp_client3 send paths: the assignment's 500-byte send() loop, large-chunk
+writev (-v) and sendfile (-s), each with and without TCP_CORK (-k) and TCP_NODELAY (-N).
+Every transfer goes to tcp_ser3 -e, which has no file size limit. Reports transfer
+time, throughput, send syscalls and the TCP segments the client put on the wire.
+"""
+
+import argparse
+import filecmp
+import glob
+import os
+import re
+import shutil
+import signal
+import subprocess
+import tempfile
+import time
+from statistics import mean
+
+from bench_ser3 import compile_program, make_payload
+
+MODES = (
+    ("send 500", []),
+    ("send 500 nodelay", ["-N"]),
+    ("send 500 cork", ["-k"]),
+    ("writev", ["-v"]),
+    ("writev cork", ["-v", "-k"]),
+    ("sendfile", ["-s"]),
+    ("sendfile cork", ["-s", "-k"]),
+)
+
+
+def run_transfer(server, client, workdir, flags, timeout, server_flags=("-e",), uploads=1):
+    """One upload of workdir/file.txt; returns the client's numbers and the server's CPU time, or None.
+    An upload split over several connections (-S) needs uploads set to their number."""
+    for old in glob.glob(os.path.join(workdir, "myTCPreceive*.txt")):
+        os.remove(old)
+    with open(os.path.join(workdir, "server.log"), "w") as log:
+        proc = subprocess.Popen([server, "-n", str(uploads)] + list(server_flags), cwd=workdir,
+                                stdout=log, stderr=subprocess.STDOUT)
+        time.sleep(0.2)  # give the server time to bind
+        try:
+            out = subprocess.run([client] + flags + ["-f", "file.txt", "localhost"], cwd=workdir,
+                                 capture_output=True, text=True, timeout=timeout).stdout
+        except subprocess.TimeoutExpired:
+            proc.kill()
+            proc.wait()
+            return None
+        if "Time(ms)" not in out:
+            os.kill(proc.pid, signal.SIGKILL)  # the upload failed; proc.kill() would reap it before wait4
+        # wait4 rather than wait: the server's user and system time, children included
+        _, _, usage = os.wait4(proc.pid, 0)
+        proc.returncode = 0
+    numbers = {"server_cpu_ms": (usage.ru_utime + usage.ru_stime) * 1000}
+    for key, pattern in (("time_ms", r"Time\(ms\)\s*:\s*([0-9.]+)"), ("calls", r"Send syscalls:\s*([0-9]+)"),
+                         ("segments", r"Segments sent:\s*([0-9]+)")):
+        match = re.search(pattern, out)
+        if match is None:
+            return None
+        numbers[key] = float(match.group(1))
+    received = glob.glob(os.path.join(workdir, "myTCPreceive*.txt"))
+    numbers["intact"] = len(received) == 1 and filecmp.cmp(os.path.join(workdir, "file.txt"), received[0],
+                                                           shallow=False)
+    return numbers
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--sizes", default="1048576,67108864", help="comma separated file sizes in bytes")
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--timeout", type=int, default=120)
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix="bench_client3_")
+    try:
+        server = compile_program(workdir, "tcp_ser3.c")
+        client = compile_program(workdir, "tcp_client3.c")
+        print(f"{'size':>10} {'mode':>17} {'time ms':>9} {'MB/s':>8} {'syscalls':>9} {'segments':>9}")
+        for size in [int(s) for s in args.sizes.split(",")]:
+            with open(os.path.join(workdir, "file.txt"), "wb") as f:
+                f.write(make_payload(size)[:-1])  # the client adds the end byte itself
+            for name, flags in MODES:
+                runs = [run_transfer(server, client, workdir, flags, args.timeout) for _ in range(args.iterations)]
+                runs = [r for r in runs if r and r["intact"]]
+                if not runs:
+                    print(f"{size:>10} {name:>17}  all runs failed")
+                    continue
+                t = mean(r["time_ms"] for r in runs)
+                print(f"{size:>10} {name:>17} {t:>9.2f} {size / t / 1000:>8.2f} "
+                      f"{runs[0]['calls']:>9.0f} {mean(r['segments'] for r in runs):>9.0f}")
+    finally:
+        shutil.rmtree(workdir)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""
+Compare the '\\0' end byte (every chunk's last byte checked) with framed uploads (-F: a
+header with the 64-bit size first, then exactly that many bytes, read in MSG_WAITALL
+blocks by the forked server). Each mode sends a text file and a binary file with
+writev (-v); the binary one has zero bytes that the sentinel protocol stumbles over.
+Reports transfer time, throughput, server CPU time and how many runs arrived intact.
+"""
+
+import argparse
+import os
+import shutil
+import tempfile
+from statistics import mean
+
+from bench_client3 import run_transfer
+from bench_recv3 import make_text_file
+from bench_ser3 import compile_program
+
+MODES = (
+    # name, server flags, client flags
+    ("sentinel", ["-e"], ["-v"]),
+    ("framed", ["-e", "-F"], ["-v", "-F"]),
+    ("framed waitall", ["-F"], ["-v", "-F"]),
+    ("sentinel splice", ["-e", "-z"], ["-v"]),
+    ("framed splice", ["-e", "-F", "-z"], ["-v", "-F"]),
+)
+
+
+def make_binary_file(path, size):
+    with open(path, "wb") as f:
+        while size > 0:
+            f.write(os.urandom(min(size, 1 << 20)))
+            size -= 1 << 20
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--sizes", default="1048576,67108864", help="comma separated file sizes in bytes")
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--timeout", type=int, default=60)
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix="bench_frame3_")
+    try:
+        server = compile_program(workdir, "tcp_ser3.c")
+        client = compile_program(workdir, "tcp_client3.c")
+        print(f"{'size':>10} {'file':>6} {'mode':>16} {'time ms':>9} {'MB/s':>8} {'server cpu ms':>14} {'intact':>7}")
+        for size in [int(s) for s in args.sizes.split(",")]:
+            for kind, make in (("text", make_text_file), ("binary", make_binary_file)):
+                make(os.path.join(workdir, "file.txt"), size)
+                for name, server_flags, client_flags in MODES:
+                    runs = [run_transfer(server, client, workdir, client_flags, args.timeout, server_flags)
+                            for _ in range(args.iterations)]
+                    good = [r for r in runs if r and r["intact"]]
+                    if not good:
+                        print(f"{size:>10} {kind:>6} {name:>16} {'-':>9} {'-':>8} {'-':>14} "
+                              f"{0:>3}/{args.iterations}")
+                        continue
+                    t = mean(r["time_ms"] for r in good)
+                    print(f"{size:>10} {kind:>6} {name:>16} {t:>9.2f} {size / t / 1000:>8.2f} "
+                          f"{mean(r['server_cpu_ms'] for r in good):>14.1f} {len(good):>3}/{args.iterations}")
+    finally:
+        shutil.rmtree(workdir)
+
+
+if __name__ == "__main__":
+    main()
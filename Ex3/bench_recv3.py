@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""
+Compare the tcp_ser3 receive paths on large files: recv() + write() in the event loop
+(-e), splice() through a pipe in the event loop (-e -z) and in a forked child (-z).
+The client sends with sendfile (-s -k) so the sender is not what limits the transfer.
+Reports transfer time, throughput and the CPU time the server spent.
+"""
+
+import argparse
+import os
+import shutil
+import tempfile
+from statistics import mean
+
+from bench_client3 import run_transfer
+from bench_ser3 import compile_program
+
+MODES = (
+    ("recv+write", ["-e"]),
+    ("splice", ["-e", "-z"]),
+    ("fork splice", ["-z"]),
+)
+
+
+def make_text_file(path, size):
+    """size bytes of text without zero bytes, written a megabyte at a time"""
+    line = b"the quick brown fox jumps over the lazy dog 0123456789\n"
+    block = (line * ((1 << 20) // len(line) + 1))[:1 << 20]
+    with open(path, "wb") as f:
+        while size > 0:
+            f.write(block[:size])
+            size -= len(block)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--sizes", default="67108864,1073741824", help="comma separated file sizes in bytes")
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--timeout", type=int, default=600)
+    parser.add_argument("--dir", default=None, help="where the files are written (the disk under test)")
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix="bench_recv3_", dir=args.dir)
+    try:
+        server = compile_program(workdir, "tcp_ser3.c")
+        client = compile_program(workdir, "tcp_client3.c")
+        print(f"{'size':>11} {'mode':>12} {'time ms':>10} {'MB/s':>8} {'server cpu ms':>14}")
+        for size in [int(s) for s in args.sizes.split(",")]:
+            make_text_file(os.path.join(workdir, "file.txt"), size)
+            for name, flags in MODES:
+                runs = [run_transfer(server, client, workdir, ["-s", "-k"], args.timeout, flags)
+                        for _ in range(args.iterations)]
+                runs = [r for r in runs if r and r["intact"]]
+                if not runs:
+                    print(f"{size:>11} {name:>12}  all runs failed")
+                    continue
+                t = mean(r["time_ms"] for r in runs)
+                print(f"{size:>11} {name:>12} {t:>10.1f} {size / t / 1000:>8.2f} "
+                      f"{mean(r['server_cpu_ms'] for r in runs):>14.1f}")
+    finally:
+        shutil.rmtree(workdir)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""
+Compare the fork-per-connection tcp_ser3 with its epoll event loop (-e). A single
+asyncio process plays thousands of tcp_client3 uploads (the file, the '\\0' end byte,
+wait for the 2-byte ack), keeping --concurrency of them open at a time. Small files
+measure connections per second, larger ones aggregate throughput.
+"""
+
+import argparse
+import asyncio
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+
+EX3_DIR = os.path.dirname(os.path.abspath(__file__))
+PORT = 4950  # MYTCP_PORT
+ACK = b"\x01\x00"
+
+MODES = (("fork", []), ("epoll", ["-e"]))
+
+
+def compile_program(build_dir, source):
+    """Compile one Ex3 source into build_dir and return the program's path"""
+    path = os.path.join(build_dir, os.path.splitext(source)[0])
+    result = subprocess.run(["gcc", "-O2", "-pthread", os.path.join(EX3_DIR, source), "-o", path],
+                            capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"compiling {source} failed:\n{result.stderr}")
+    return path
+
+
+def make_payload(size):
+    """Text without zero bytes, followed by the end byte the server looks for"""
+    line = b"the quick brown fox jumps over the lazy dog 0123456789\n"
+    return (line * (size // len(line) + 1))[:size] + b"\0"
+
+
+async def upload(payload, gate, latencies):
+    async with gate:
+        start = time.monotonic()
+        try:
+            reader, writer = await asyncio.open_connection("127.0.0.1", PORT)
+            writer.write(payload)
+            await writer.drain()
+            ack = await reader.readexactly(2)
+            writer.close()
+        except (OSError, asyncio.IncompleteReadError):
+            return False
+        latencies.append(time.monotonic() - start)
+        return ack == ACK
+
+
+async def run_uploads(uploads, concurrency, payload):
+    gate = asyncio.Semaphore(concurrency)
+    latencies = []
+    start = time.monotonic()
+    ok = await asyncio.gather(*(upload(payload, gate, latencies) for _ in range(uploads)))
+    return time.monotonic() - start, sum(ok), sorted(latencies)
+
+
+def run_mode(server, workdir, flags, uploads, concurrency, payload, timeout):
+    with open(os.path.join(workdir, "server.log"), "w") as log:
+        proc = subprocess.Popen([server, "-n", str(uploads)] + flags, cwd=workdir,
+                                stdout=log, stderr=subprocess.STDOUT)
+        time.sleep(0.3)  # give the server time to bind
+        try:
+            result = asyncio.run(asyncio.wait_for(run_uploads(uploads, concurrency, payload), timeout))
+        except asyncio.TimeoutError:
+            result = None
+        try:
+            proc.wait(timeout=timeout)
+        except subprocess.TimeoutExpired:
+            proc.kill()
+            proc.wait()
+    for name in os.listdir(workdir):
+        if name.startswith("myTCPreceive"):
+            os.remove(os.path.join(workdir, name))
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--uploads", type=int, default=2000)
+    parser.add_argument("--concurrency", default="10,100,1000", help="comma separated uploads in flight")
+    parser.add_argument("--sizes", default="1000,50000",
+                        help="comma separated file sizes; the fork server keeps a file in BUFSIZE (60000) bytes")
+    parser.add_argument("--timeout", type=int, default=300)
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix="bench_ser3_")
+    try:
+        server = compile_program(workdir, "tcp_ser3.c")
+        print(f"{'size':>7} {'conc':>6} {'mode':>6} {'wall s':>8} {'conn/s':>9} {'MB/s':>8} "
+              f"{'p50 ms':>8} {'p99 ms':>8} {'acked':>7}")
+        for size in [int(s) for s in args.sizes.split(",")]:
+            payload = make_payload(size)
+            for concurrency in [int(c) for c in args.concurrency.split(",")]:
+                for mode, flags in MODES:
+                    result = run_mode(server, workdir, flags, args.uploads, concurrency, payload, args.timeout)
+                    if result is None:
+                        print(f"{size:>7} {concurrency:>6} {mode:>6}  timed out")
+                        continue
+                    elapsed, acked, lat = result
+                    p50 = lat[len(lat) // 2] * 1000 if lat else 0
+                    p99 = lat[min(len(lat) - 1, len(lat) * 99 // 100)] * 1000 if lat else 0
+                    print(f"{size:>7} {concurrency:>6} {mode:>6} {elapsed:>8.2f} {acked / elapsed:>9.0f} "
+                          f"{acked * size / elapsed / 1e6:>8.2f} {p50:>8.2f} {p99:>8.2f} {acked:>7}")
+    finally:
+        shutil.rmtree(workdir)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""
+Throughput against stream count for tcp_client3 -S: the file is split into one range per
+stream and each range is sent by its own thread over its own connection, to the forking
+server and to the event loop (-e), both framed (-F) and writing every range at its offset.
+Reports transfer time, aggregate throughput, the speedup over one stream, server CPU time
+and how many runs arrived intact.
+"""
+
+import argparse
+import os
+import shutil
+import tempfile
+from statistics import mean
+
+from bench_client3 import run_transfer
+from bench_frame3 import make_binary_file
+from bench_ser3 import compile_program
+
+SERVERS = (
+    ("fork", ["-F"]),
+    ("events", ["-e", "-F"]),
+)
+
+SENDERS = (
+    ("writev", ["-v"]),
+    ("sendfile", ["-s"]),
+)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--size", type=int, default=256 * 1024 * 1024, help="file size in bytes")
+    parser.add_argument("--streams", default="1,2,4,8,16", help="comma separated stream counts")
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--timeout", type=int, default=120)
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix="bench_streams3_")
+    try:
+        server = compile_program(workdir, "tcp_ser3.c")
+        client = compile_program(workdir, "tcp_client3.c")
+        make_binary_file(os.path.join(workdir, "file.txt"), args.size)
+        print(f"{'server':>7} {'sender':>9} {'streams':>8} {'time ms':>9} {'MB/s':>8} {'speedup':>8} "
+              f"{'server cpu ms':>14} {'intact':>7}")
+        for server_name, server_flags in SERVERS:
+            for sender, flags in SENDERS:
+                base = None
+                for n in [int(s) for s in args.streams.split(",")]:
+                    stream_flags = flags + (["-S", str(n)] if n > 1 else ["-F"])
+                    runs = [run_transfer(server, client, workdir, stream_flags, args.timeout, server_flags, n)
+                            for _ in range(args.iterations)]
+                    good = [r for r in runs if r and r["intact"]]
+                    if not good:
+                        print(f"{server_name:>7} {sender:>9} {n:>8} {'-':>9} {'-':>8} {'-':>8} {'-':>14} "
+                              f"{0:>3}/{args.iterations}")
+                        continue
+                    rate = args.size / mean(r["time_ms"] for r in good) / 1000
+                    base = base or rate
+                    print(f"{server_name:>7} {sender:>9} {n:>8} {mean(r['time_ms'] for r in good):>9.2f} "
+                          f"{rate:>8.2f} {rate / base:>7.2f}x {mean(r['server_cpu_ms'] for r in good):>14.1f} "
+                          f"{len(good):>3}/{args.iterations}")
+    finally:
+        shutil.rmtree(workdir)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,4 +1,5 @@
 // headfile for TCP program
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <stdio.h>
@@ -12,6 +13,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <linux/tcp.h>
+#include <pthread.h>
 
 #define NEWFILE (O_WRONLY|O_CREAT|O_TRUNC)
 #define MYTCP_PORT 4950
@@ -33,3 +41,36 @@ struct ack_so
 uint8_t num;
 uint8_t len;
 };
+
+#define HEAD_MAGIC 0x46334354		// "TC3F", a framed upload (-F)
+#define HEAD_VERSION 2
+#define HEAD_NAMELEN 64
+#define MAXSTREAMS 64				// -S: most connections one upload is split over
+
+struct head_so			//sent before the file in a framed upload, instead of the end byte after it
+{
+uint32_t magic;				// HEAD_MAGIC
+uint32_t version;			// HEAD_VERSION
+uint64_t size;				// file bytes that follow the header (this stream's range with -S)
+int64_t mtime;				// modification time of the sent file, seconds since the epoch
+uint32_t mode;				// permission bits of the sent file
+uint16_t stream;			// -S: which connection of the upload this is, from 0
+uint16_t streams;			// -S: connections the file is split over, 1 = all of it on this one
+uint64_t offset;			// where in the file the size bytes go
+uint64_t total;				// size of the whole file
+uint32_t upload;			// -S, -r: the same on every stream of one upload, names the output file
+uint32_t resume;			// -r: the server first answers with the bytes of the range it has already
+char name[HEAD_NAMELEN];	// name of the sent file, only printed by the server
+};
+
+#define CKPT_MAGIC 0x4b433354		// "T3CK", a used slot of a checkpoint file
+#define CHECKPOINT_BYTES (4 * 1024 * 1024)	// -r: the server makes what it received durable this often
+
+struct ckpt_so			//-r: one slot per stream of myTCPreceive-<upload>.ckpt, at stream * sizeof
+{
+uint32_t magic;				// CKPT_MAGIC
+uint32_t streams;			// streams of the upload, a slot only counts for the same split
+uint64_t offset;			// the stream's range ...
+uint64_t size;
+uint64_t done;				// ... and how much of it, from offset on, is durably in the file
+};
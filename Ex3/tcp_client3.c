@@ -3,26 +3,113 @@ tcp_client.c: the source file of the client in tcp transmission
 ********************************/
 
 #include "headsock.h"
+#include "timing.h"
 
-float str_cli(FILE *fp, int sockfd, long *len);                       //transmission function
-void tv_sub(struct  timeval *out, struct timeval *in);	    //calcu the time interval between out and in
+#define WRITEV_CHUNK 65536		// -v: default bytes per iovec
+#define WRITEV_IOVS 16			// -v: iovecs per writev call
+
+struct stream_so			//-S: one connection of a parallel upload and its thread
+{
+pthread_t thread;
+int stream;					// which one, from 0
+struct sockaddr_in *addr;	// where to connect
+FILE *fp;					// the file, for sendfile
+char *buf;					// ... or the loaded file
+long offset, size;			// the range of the file this connection sends
+long total;					// size of the whole file
+long skip;					// -r: bytes of the range the server had already
+long sent;					// bytes sent
+long calls;					// send syscalls made
+unsigned segs;				// TCP segments sent
+double ms;					// transfer time: first byte, steady and ack wait of this connection
+};
+
+double str_cli(FILE *fp, int sockfd, long *len);                      //transmission function
+double str_cli_streams(FILE *fp, struct sockaddr_in *addr, long *len);  //-S: ranges over parallel connections
+void *send_stream(void *arg);                                         //-S: one range, in its own thread
+int connect_to(struct sockaddr_in *addr);
+long send_small(int sockfd, char *buf, long total);                   //DATALEN pieces, one send each
+long send_writev(int sockfd, char *buf, long total);                  //large pieces, several per writev
+long send_file(int sockfd, FILE *fp, long offset, long lsize);        //sendfile, the file never enters user space
+void send_head(int sockfd, FILE *fp, int stream, long offset, long size, long total);	//-F: the header in front of the file
+long recv_skip(int sockfd);                                           //-r: the server's answer to the header
+uint32_t file_key(FILE *fp);
+void set_opt(int sockfd, int opt, int on);
+
+int use_sendfile = 0;		// -s: send with sendfile()
+int use_writev = 0;			// -v: send with writev() in chunks of -b bytes
+long chunk = WRITEV_CHUNK;	// -b: bytes per iovec with -v
+int cork = 0;				// -k: TCP_CORK while sending, full segments only
+int nodelay = 0;			// -N: TCP_NODELAY, no Nagle delay for small sends
+char *filename = "myfile.txt";	// -f: the file to send
+int framed = 0;				// -F: send a head_so with the size first, no end byte
+int streams = 1;			// -S: connections (and threads) the file is split over
+int resume = 0;				// -r: resumable, only what the server does not have yet is sent
+uint32_t upload;			// -S, -r: names the upload on every stream
+// Per thread, so every stream of -S counts and times itself
+__thread long send_calls = 0;		// send/writev/sendfile syscalls made for the file
+__thread struct timing_so timing;	// time spent in each phase of the transfer
 
 int main(int argc, char **argv)
 {
-	int sockfd, ret;
-	float ti, rt;
+	int sockfd;
+	double ti, rt;
 	long len;
 	struct sockaddr_in ser_addr;
 	char ** pptr;
 	struct hostent *sh;
 	struct in_addr **addrs;
 	FILE *fp;
+	int opt;
+	struct tcp_info info;
+	socklen_t info_len = sizeof(info);
+	int have_info;
 
-	if (argc != 2) {
-		printf("parameters not match");
+	timing_init(&timing);
+	while ((opt = getopt(argc, argv, "svb:kNf:FS:r")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				use_sendfile = 1;
+				break;
+			case 'v':
+				use_writev = 1;
+				break;
+			case 'b':
+				chunk = atol(optarg);
+				break;
+			case 'k':
+				cork = 1;
+				break;
+			case 'N':
+				nodelay = 1;
+				break;
+			case 'f':
+				filename = optarg;
+				break;
+			case 'F':
+				framed = 1;
+				break;
+			case 'S':
+				streams = atoi(optarg);
+				break;
+			case 'r':
+				resume = 1;
+				break;
+			default:
+				argc = 0;
+				break;
+		}
+	}
+	if (argc - optind != 1 || chunk <= 0 || streams < 1 || streams > MAXSTREAMS) {
+		printf("usage: %s [-s | -v [-b chunk]] [-k] [-N] [-F] [-S streams] [-r] [-f file] hostname\n", argv[0]);
+		exit(1);
 	}
+	if (streams > 1 || resume)
+		framed = 1;                                                    //every range needs its header
 
-	sh = gethostbyname(argv[1]);	                                       //get host's information
+	sh = gethostbyname(argv[optind]);	                                       //get host's information
 	if (sh == NULL) {
 		printf("error when gethostby name");
 		exit(0);
@@ -42,100 +129,401 @@ int main(int argc, char **argv)
 	}
         
 	addrs = (struct in_addr **)sh->h_addr_list;
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);                           //create the socket
-	if (sockfd <0)
-	{
-		printf("error in socket");
-		exit(1);
-	}
 	ser_addr.sin_family = AF_INET;                                                      
 	ser_addr.sin_port = htons(MYTCP_PORT);
 	memcpy(&(ser_addr.sin_addr.s_addr), *addrs, sizeof(struct in_addr));
 	bzero(&(ser_addr.sin_zero), 8);
-	ret = connect(sockfd, (struct sockaddr *)&ser_addr, sizeof(struct sockaddr));         //connect the socket with the host
-	if (ret != 0) {
-		printf ("connection failed\n"); 
-		close(sockfd); 
-		exit(1);
+
+	if (streams > 1)
+	{
+		if((fp = fopen (filename,"r+t")) == NULL)
+		{
+			printf("File doesn't exit\n");
+			exit(0);
+		}
+		ti = str_cli_streams(fp, &ser_addr, &len);
+		fclose(fp);
+		timing_phase(&timing, -1);
+		rt = len / ti;
+		printf("Time(ms) : %.3f, Data sent(byte): %ld\nData rate: %f (Kbytes/s)\n", ti, len, rt);
+		timing_print(&timing);
+		exit(0);
 	}
+
+	sockfd = connect_to(&ser_addr);
 	
-	if((fp = fopen ("myfile.txt","r+t")) == NULL)
+	if((fp = fopen (filename,"r+t")) == NULL)
 	{
 		printf("File doesn't exit\n");
 		exit(0);
 	}
 
 	ti = str_cli(fp, sockfd, &len);                       //perform the transmission and receiving
-	rt = (len/(float)ti);                                         //caculate the average transmission rate
-	printf("Time(ms) : %.3f, Data sent(byte): %d\nData rate: %f (Kbytes/s)\n", ti, (int)len, rt);
-
+	have_info = getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0;
 	close(sockfd);
 	fclose(fp);
+	timing_phase(&timing, -1);
+
+	rt = len / ti;                                                //caculate the average transmission rate
+	printf("Time(ms) : %.3f, Data sent(byte): %ld\nData rate: %f (Kbytes/s)\n", ti, len, rt);
+	timing_print(&timing);
+	printf("Send syscalls: %ld\n", send_calls);
+	if (have_info)
+		printf("Segments sent: %u\n", info.tcpi_segs_out);
 //}
 	exit(0);
 }
 
-float str_cli(FILE *fp, int sockfd, long *len)
+double str_cli(FILE *fp, int sockfd, long *len)
 {
-	char *buf;
-	long lsize, ci;
-	char sends[DATALEN];
+	char *buf = NULL;
+	long lsize, total, ci, skip = 0;
 	struct ack_so ack;
-	int n, slen;
-	float time_inv = 0.0;
-	struct timeval sendt, recvt;
-	ci = 0;
+	int n;
 
 	fseek (fp , 0 , SEEK_END);
 	lsize = ftell (fp);
 	rewind (fp);
-	printf("The file length is %d bytes\n", (int)lsize);
-	printf("the packet length is %d bytes\n",DATALEN);
+	total = framed ? lsize : lsize + 1;							//the end byte only without a header
+	printf("The file length is %ld bytes\n", lsize);
+	if (resume)
+		upload = file_key(fp);
+	if (use_sendfile)
+		printf("the file is sent with sendfile\n");
+	else if (use_writev)
+		printf("the file is sent with writev, %d iovecs of %ld bytes\n", WRITEV_IOVS, chunk);
+	else
+		printf("the packet length is %d bytes\n",DATALEN);
 
-// allocate memory to contain the whole file.
-	buf = (char *) malloc (lsize);
-	if (buf == NULL) exit (2);
+	timing_phase(&timing, PH_LOAD);
+	if (!use_sendfile)
+	{
+// allocate memory to contain the whole file and the end byte.
+		buf = (char *) malloc (lsize + 1);
+		if (buf == NULL) exit (2);
 
   // copy the file into the buffer.
-	fread (buf,1,lsize,fp);
+		fread (buf,1,lsize,fp);
 
   /*** the whole file is loaded in the buffer. ***/
-	buf[lsize] ='\0';									//append the end byte
-	gettimeofday(&sendt, NULL);							//get the current time
-	while(ci<= lsize)
+		buf[lsize] ='\0';									//append the end byte
+	}
+	if (cork)
+		set_opt(sockfd, TCP_CORK, 1);						//only full segments until uncorked
+	timing_phase(&timing, PH_FIRST);					//the transfer starts
+	if (framed)
+		send_head(sockfd, fp, 0, 0, lsize, lsize);
+	if (resume)
+	{
+		skip = recv_skip(sockfd);
+		printf("Resumed: %ld of %ld bytes were stored already (upload %08x)\n", skip, lsize, upload);
+	}
+	if (use_sendfile)
+		ci = send_file(sockfd, fp, skip, lsize - skip);
+	else if (use_writev)
+		ci = send_writev(sockfd, buf + skip, total - skip);
+	else
+		ci = send_small(sockfd, buf + skip, total - skip);
+	if (cork)
+		set_opt(sockfd, TCP_CORK, 0);						//push out the last partial segment
+	timing_phase(&timing, PH_ACK_WAIT);
+	if ((n= recv(sockfd, &ack, 2, 0))==-1)                                   //receive the ack
+	{
+		printf("error when receiving\n");
+		exit(1);
+	}
+	if (ack.num != 1|| ack.len != 0)
+		printf("error in transmission\n");
+	timing_phase(&timing, PH_TEARDOWN);
+	*len= ci;
+	free(buf);
+	return timing_transfer_ms(&timing);
+}
+
+// -S: the file is cut into one range per stream, each sent over its own connection by its own
+// thread, header first, and acked on its own. The server writes every range at its offset, so
+// the ranges may arrive in any order. The time is from starting the threads until the last ack.
+double str_cli_streams(FILE *fp, struct sockaddr_in *addr, long *len)
+{
+	struct stream_so st[MAXSTREAMS];
+	char *buf = NULL;
+	long lsize, range, calls = 0, skipped = 0;
+	unsigned segs = 0;
+	int i;
+
+	fseek (fp , 0 , SEEK_END);
+	lsize = ftell (fp);
+	rewind (fp);
+	range = (lsize + streams - 1) / streams;
+	range = (range + 4095) & ~4095L;						//whole pages, so no two threads share one
+	upload = resume ? file_key(fp) : getpid() ^ (uint32_t)mono_ns();
+	printf("The file length is %ld bytes, sent as %d streams of up to %ld bytes (upload %08x)\n",
+		lsize, streams, range, upload);
+
+	timing_phase(&timing, PH_LOAD);
+	if (!use_sendfile)
+	{
+		buf = (char *) malloc (lsize + 1);
+		if (buf == NULL) exit (2);
+		fread (buf,1,lsize,fp);
+	}
+	timing_phase(&timing, PH_FIRST);
+	for (i = 0; i < streams; i++)
+	{
+		st[i].stream = i;
+		st[i].addr = addr;
+		st[i].fp = fp;
+		st[i].buf = buf;
+		st[i].total = lsize;
+		st[i].offset = i * range < lsize ? i * range : lsize;
+		st[i].size = lsize - st[i].offset < range ? lsize - st[i].offset : range;
+		if (pthread_create(&st[i].thread, NULL, send_stream, &st[i]) != 0)
+		{
+			printf("error creating thread %d\n", i);
+			exit(1);
+		}
+	}
+	timing_phase(&timing, PH_STEADY);
+	*len = 0;
+	for (i = 0; i < streams; i++)
+	{
+		pthread_join(st[i].thread, NULL);
+		*len += st[i].sent;
+		skipped += st[i].skip;
+		calls += st[i].calls;
+		segs += st[i].segs;
+	}
+	timing_phase(&timing, PH_TEARDOWN);
+	free(buf);
+	for (i = 0; i < streams; i++)
+		printf("Stream %d: %ld bytes at offset %ld, %.3f ms, %.1f Mbit/s, %ld send syscalls, %u segments\n",
+			i, st[i].sent, st[i].offset + st[i].skip, st[i].ms, st[i].ms > 0 ? st[i].sent * 8 / st[i].ms / 1000 : 0,
+			st[i].calls, st[i].segs);
+	if (resume)
+		printf("Resumed: %ld of %ld bytes were stored already\n", skipped, lsize);
+	printf("Send syscalls: %ld\n", calls);
+	printf("Segments sent: %u\n", segs);
+	return timing_transfer_ms(&timing);
+}
+
+void *send_stream(void *arg)
+{
+	struct stream_so *st = arg;
+	struct ack_so ack;
+	struct tcp_info info;
+	socklen_t info_len = sizeof(info);
+	int sockfd;
+
+	timing_init(&timing);
+	sockfd = connect_to(st->addr);
+	if (cork)
+		set_opt(sockfd, TCP_CORK, 1);
+	timing_phase(&timing, PH_FIRST);
+	send_head(sockfd, st->fp, st->stream, st->offset, st->size, st->total);
+	st->skip = resume ? recv_skip(sockfd) : 0;
+	if (use_sendfile)
+		st->sent = send_file(sockfd, st->fp, st->offset + st->skip, st->size - st->skip);
+	else if (use_writev)
+		st->sent = send_writev(sockfd, st->buf + st->offset + st->skip, st->size - st->skip);
+	else
+		st->sent = send_small(sockfd, st->buf + st->offset + st->skip, st->size - st->skip);
+	if (cork)
+		set_opt(sockfd, TCP_CORK, 0);
+	timing_phase(&timing, PH_ACK_WAIT);
+	if (recv(sockfd, &ack, 2, MSG_WAITALL) != 2 || ack.num != 1 || ack.len != 0)
+	{
+		printf("error in transmission of stream %d\n", st->stream);
+		exit(1);
+	}
+	timing_phase(&timing, PH_TEARDOWN);
+	st->ms = timing_transfer_ms(&timing);
+	st->calls = send_calls;
+	st->segs = getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0 ? info.tcpi_segs_out : 0;
+	close(sockfd);
+	return NULL;
+}
+
+int connect_to(struct sockaddr_in *addr)
+{
+	int sockfd;
+
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);                           //create the socket
+	if (sockfd <0)
+	{
+		printf("error in socket");
+		exit(1);
+	}
+	if (connect(sockfd, (struct sockaddr *)addr, sizeof(struct sockaddr)) != 0) {     //connect the socket with the host
+		printf ("connection failed\n"); 
+		close(sockfd); 
+		exit(1);
+	}
+	if (nodelay)
+		set_opt(sockfd, TCP_NODELAY, 1);
+	return sockfd;
+}
+
+// The assignment's sender: every DATALEN bytes are copied into sends[] and sent on their own
+long send_small(int sockfd, char *buf, long total)
+{
+	char sends[DATALEN];
+	long ci = 0;
+	int n, slen;
+
+	while(ci < total)
 	{
-		if ((lsize+1-ci) <= DATALEN)
-			slen = lsize+1-ci;
+		if ((total-ci) <= DATALEN)
+			slen = total-ci;
 		else 
 			slen = DATALEN;
 		memcpy(sends, (buf+ci), slen);
 		n = send(sockfd, &sends, slen, 0);
+		send_calls++;
+		timing_sent(&timing);
 		if(n == -1) {
 			printf("send error!");								//send the data
 			exit(1);
 		}
 		ci += slen;
 	}
-	if ((n= recv(sockfd, &ack, 2, 0))==-1)                                   //receive the ack
+	return ci;
+}
+
+// total bytes straight from buf, up to WRITEV_IOVS chunks per call
+long send_writev(int sockfd, char *buf, long total)
+{
+	struct iovec iov[WRITEV_IOVS];
+	long ci = 0, pos;
+	ssize_t n;
+	int cnt;
+
+	while (ci < total)
 	{
-		printf("error when receiving\n");
+		pos = ci;
+		for (cnt = 0; cnt < WRITEV_IOVS && pos < total; cnt++)
+		{
+			iov[cnt].iov_base = buf + pos;
+			iov[cnt].iov_len = total - pos < chunk ? total - pos : chunk;
+			pos += iov[cnt].iov_len;
+		}
+		n = writev(sockfd, iov, cnt);
+		send_calls++;
+		timing_sent(&timing);
+		if (n == -1) {
+			printf("writev error!");
+			exit(1);
+		}
+		ci += n;                                                   //a short write resumes where it stopped
+	}
+	return ci;
+}
+
+// The kernel reads the file into the socket itself; the end byte, if any, follows with a send
+long send_file(int sockfd, FILE *fp, long offset, long lsize)
+{
+	off_t off = offset;
+	ssize_t n;
+	char end = '\0';
+
+	while (off < offset + lsize)
+	{
+		n = sendfile(sockfd, fileno(fp), &off, offset + lsize - off);
+		send_calls++;
+		timing_sent(&timing);
+		if (n <= 0) {
+			printf("sendfile error!");
+			exit(1);
+		}
+	}
+	if (framed)
+		return off - offset;
+	if (send(sockfd, &end, 1, 0) == -1)
+	{
+		printf("send error!");
 		exit(1);
 	}
-	if (ack.num != 1|| ack.len != 0)
-		printf("error in transmission\n");
-	gettimeofday(&recvt, NULL);
-	*len= ci;                                                         //get current time
-	tv_sub(&recvt, &sendt);                                                                 // get the whole trans time
-	time_inv += (recvt.tv_sec)*1000.0 + (recvt.tv_usec)/1000.0;
-	return(time_inv);
+	send_calls++;
+	timing_sent(&timing);
+	return off - offset + 1;
 }
 
-void tv_sub(struct  timeval *out, struct timeval *in)
+void send_head(int sockfd, FILE *fp, int stream, long offset, long size, long total)
 {
-	if ((out->tv_usec -= in->tv_usec) <0)
+	struct head_so head;
+	struct stat st;
+	char *name;
+
+	memset(&head, 0, sizeof(head));
+	head.magic = HEAD_MAGIC;
+	head.version = HEAD_VERSION;
+	head.size = size;
+	head.stream = stream;
+	head.streams = streams;
+	head.offset = offset;
+	head.total = total;
+	head.upload = upload;
+	head.resume = resume;
+	if (fstat(fileno(fp), &st) == 0)
+	{
+		head.mtime = st.st_mtime;
+		head.mode = st.st_mode & 07777;
+	}
+	name = strrchr(filename, '/');
+	strncpy(head.name, name ? name + 1 : filename, HEAD_NAMELEN - 1);
+	if (send(sockfd, &head, sizeof(head), 0) != sizeof(head))
 	{
-		--out ->tv_sec;
-		out ->tv_usec += 1000000;
+		printf("send error!");
+		exit(1);
 	}
-	out->tv_sec -= in->tv_sec;
+	send_calls++;
+	timing_sent(&timing);
 }
+
+// -r: the server answers the header with how many bytes of the range it has stored, as a
+// uint64_t; the data continues after them. A corked header is pushed out first, the server
+// cannot answer what it has not got.
+long recv_skip(int sockfd)
+{
+	uint64_t skip;
+
+	if (cork)
+	{
+		set_opt(sockfd, TCP_CORK, 0);
+		set_opt(sockfd, TCP_CORK, 1);
+	}
+	if (recv(sockfd, &skip, sizeof(skip), MSG_WAITALL) != sizeof(skip))
+	{
+		printf("error when receiving the resume point\n");
+		exit(1);
+	}
+	return skip;
+}
+
+// -r: names the upload after the file, so a rerun finds what the last one left on the server;
+// FNV-1a over the name, size and modification time, a changed file is a new upload
+uint32_t file_key(FILE *fp)
+{
+	struct stat st;
+	uint64_t v[2] = {0, 0};
+	uint32_t h = 2166136261u;
+	unsigned char *p;
+	unsigned i;
+
+	if (fstat(fileno(fp), &st) == 0)
+	{
+		v[0] = st.st_size;
+		v[1] = st.st_mtime;
+	}
+	for (p = (unsigned char *)filename; *p; p++)
+		h = (h ^ *p) * 16777619u;
+	for (p = (unsigned char *)v, i = 0; i < sizeof(v); i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+void set_opt(int sockfd, int opt, int on)
+{
+	if (setsockopt(sockfd, IPPROTO_TCP, opt, &on, sizeof(on)) < 0)
+		printf("setsockopt %d failed: %s\n", opt, strerror(errno));
+}
+
@@ -5,19 +5,86 @@ tcp_ser.c: the source file of the server in tcp transmission
 
 #include "headsock.h"
 
-#define BACKLOG 10
+#define BACKLOG SOMAXCONN		// a burst of clients waits here instead of being refused
+#define EV_READ 65536			// -e: bytes read from one connection per wakeup
+#define EV_EVENTS 256			// -e: events taken from epoll at once
+#define SPLICE_LEN 1048576		// -z: bytes moved through the pipe per splice
+#define SPLICEFILE (O_RDWR|O_CREAT|O_TRUNC)	// -z: the last byte of each chunk is read back
+#define FRAME_BLOCK 1048576		// -F: bytes the forked server waits for per recv
+#define RANGEFILE (O_WRONLY|O_CREAT)	// -S uploads: the other streams may have written theirs already
+#define CKPTFILE (O_RDWR|O_CREAT)	// -r uploads: slots of the other streams and of the last attempt
+
+enum { CONN_HEAD, CONN_RECV, CONN_ACK };	// -e: receiving the header (-F), the file, waiting to send the ack
+
+struct conn_so			//one upload in the event loop
+{
+int fd;						// the connected socket
+int out;					// the file being written
+int state;					// CONN_HEAD, CONN_RECV or CONN_ACK
+int id;						// numbers the output file, myTCPreceive-<id>.txt
+long received;				// bytes of the file written so far
+int head_got;				// -F: bytes of head received so far
+struct head_so head;		// -F: what the client said about the file
+int ckpt;					// -r: the upload's checkpoint file, -1 without
+long checkpointed;			// -r: bytes of received that are durable
+};
 
 void str_ser(int sockfd);                                                        // transmitting and receiving function
+void str_ser_splice(int sockfd);                                                 // the same without the data entering user space
+void str_ser_framed(int sockfd);                                                 // header first, then exactly size bytes
+int check_head(struct head_so *head);
+int open_range(struct head_so *head, char *name);
+int resume_range(int sockfd, struct head_so *head, int out, long *skip);
+void checkpoint(int ckpt, int out, struct head_so *head, long done);
+long splice_chunk(int sockfd, int out, long max, long *offset, int *end);
+void serve_fork(int sockfd);                                                    // one process per connection
+void serve_events(int sockfd);                                                  // every connection in one epoll loop
+void accept_conns(int epfd, int sockfd);
+void conn_read_head(int epfd, struct conn_so *c);
+void conn_read(int epfd, struct conn_so *c);
+void conn_received(int epfd, struct conn_so *c);
+void conn_ack(int epfd, struct conn_so *c);
+void conn_close(int epfd, struct conn_so *c);
 
-int main(void)
+int max_uploads = 0;				// -n: exit after this many uploads, 0 = run forever
+int use_splice = 0;					// -z: socket to file through a pipe with splice()
+int framed = 0;						// -F: uploads start with a head_so instead of ending with '\0'
+int accepted = 0, finished = 0, live = 0;	// -e: connections accepted, uploads done, connections open
+
+int main(int argc, char **argv)
 {
-	int sockfd, con_fd, ret;
+	int sockfd, ret, opt, events = 0;
 	struct sockaddr_in my_addr;
-	struct sockaddr_in their_addr;
-	int sin_size;
+	struct rlimit rl;
 
-//	char *buf;
-	pid_t pid;
+	while ((opt = getopt(argc, argv, "en:zF")) != -1)
+	{
+		switch (opt)
+		{
+			case 'e':
+				events = 1;
+				break;
+			case 'n':
+				max_uploads = atoi(optarg);
+				break;
+			case 'z':
+				use_splice = 1;
+				break;
+			case 'F':
+				framed = 1;
+				break;
+			default:
+				printf("usage: %s [-e] [-z] [-F] [-n uploads]\n", argv[0]);
+				exit(1);
+		}
+	}
+
+	// every connection is a descriptor (two with its output file) in the event loop
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
 
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);          //create socket
 	if (sockfd <0)
@@ -25,6 +92,8 @@ int main(void)
 		printf("error in socket!");
 		exit(1);
 	}
+	opt = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));	//restart without waiting for TIME_WAIT
 	
 	my_addr.sin_family = AF_INET;
 	my_addr.sin_port = htons(MYTCP_PORT);
@@ -43,8 +112,25 @@ int main(void)
 		exit(1);
 	}
 
-	while (1)
+	if (events)
+		serve_events(sockfd);
+	else
+		serve_fork(sockfd);
+	close(sockfd);
+	exit(0);
+}
+
+void serve_fork(int sockfd)
+{
+	int con_fd, count = 0;
+	struct sockaddr_in their_addr;
+	socklen_t sin_size;
+	pid_t pid;
+
+	while (max_uploads == 0 || count < max_uploads)
 	{
+		while (waitpid(-1, NULL, WNOHANG) > 0)                      //reap finished children
+			;
 		printf("waiting for data\n");
 		sin_size = sizeof (struct sockaddr_in);
 		con_fd = accept(sockfd, (struct sockaddr *)&their_addr, &sin_size);            //accept the packet
@@ -53,18 +139,275 @@ int main(void)
 			printf("error in accept\n");
 			exit(1);
 		}
+		count++;
 
 		if ((pid = fork())==0)                                         // creat acception process
 		{
 			close(sockfd);
-			str_ser(con_fd);                                          //receive packet and response
+			if (framed)
+				str_ser_framed(con_fd);
+			else if (use_splice)
+				str_ser_splice(con_fd);
+			else
+				str_ser(con_fd);                                          //receive packet and response
 			close(con_fd);
 			exit(0);
 		}
 		else close(con_fd);                                         //parent process
 	}
-	close(sockfd);
-	exit(0);
+	while (wait(NULL) > 0)                                          //let the last uploads finish
+		;
+}
+
+// One process, one thread: a nonblocking listening socket and every connection in an epoll
+// set. Each connection is a small state machine, CONN_RECV while the file streams into its
+// own output file and CONN_ACK once the end byte arrived, so nothing is bounded by BUFSIZE
+// and a connection costs a struct instead of a process.
+void serve_events(int sockfd)
+{
+	struct epoll_event ev, evs[EV_EVENTS];
+	struct conn_so *c;
+	int epfd, n, i;
+
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+	if ((epfd = epoll_create1(0)) < 0)
+	{
+		printf("error in epoll_create\n");
+		exit(1);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;                                             //NULL marks the listening socket
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+	printf("waiting for data\n");
+
+	while (max_uploads == 0 || finished < max_uploads || live > 0)
+	{
+		n = epoll_wait(epfd, evs, EV_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			printf("error in epoll_wait\n");
+			exit(1);
+		}
+		for (i = 0; i < n; i++)
+		{
+			c = evs[i].data.ptr;
+			if (c == NULL)
+				accept_conns(epfd, sockfd);
+			else if (c->state == CONN_HEAD)
+				conn_read_head(epfd, c);
+			else if (c->state == CONN_RECV)
+				conn_read(epfd, c);
+			else
+				conn_ack(epfd, c);
+		}
+	}
+	close(epfd);
+	printf("%d uploads received\n", finished);
+}
+
+// Take every connection waiting in the backlog
+void accept_conns(int epfd, int sockfd)
+{
+	struct epoll_event ev;
+	struct conn_so *c;
+	char name[32];
+	int fd;
+
+	while (max_uploads == 0 || accepted < max_uploads)
+	{
+		fd = accept4(sockfd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0)
+		{
+			if (errno != EAGAIN && errno != EINTR)
+				printf("error in accept: %s\n", strerror(errno));
+			return;
+		}
+		c = malloc(sizeof(*c));
+		if (c == NULL)
+		{
+			close(fd);
+			return;
+		}
+		c->fd = fd;
+		c->state = framed ? CONN_HEAD : CONN_RECV;
+		c->id = ++accepted;
+		c->received = 0;
+		c->head_got = 0;
+		c->ckpt = -1;
+		sprintf(name, "myTCPreceive-%d.txt", c->id);
+		if ((c->out = open(name, use_splice ? SPLICEFILE : NEWFILE, 0644)) < 0)
+		{
+			printf("error opening %s\n", name);
+			close(fd);
+			free(c);
+			continue;
+		}
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+		live++;
+	}
+}
+
+// -F: the header may come in pieces like anything else on a stream
+void conn_read_head(int epfd, struct conn_so *c)
+{
+	char name[32];
+	int n;
+
+	n = recv(c->fd, (char *)&c->head + c->head_got, sizeof(c->head) - c->head_got, 0);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n <= 0)
+	{
+		printf("connection %d closed before its header\n", c->id);
+		finished++;
+		conn_close(epfd, c);
+		return;
+	}
+	c->head_got += n;
+	if (c->head_got < (int)sizeof(c->head))
+		return;
+	if (check_head(&c->head) < 0)
+	{
+		printf("connection %d: not a framed upload\n", c->id);
+		finished++;
+		conn_close(epfd, c);
+		return;
+	}
+	if (c->head.streams > 1 || c->head.resume)                     //a range: into the upload's file instead
+	{
+		sprintf(name, "myTCPreceive-%d.txt", c->id);
+		unlink(name);
+		close(c->out);
+		if ((c->out = open_range(&c->head, name)) < 0)
+		{
+			printf("connection %d: error opening %s\n", c->id, name);
+			finished++;
+			conn_close(epfd, c);
+			return;
+		}
+	}
+	c->state = CONN_RECV;
+	if (c->head.resume)
+	{
+		// a fresh socket has room for the 8 byte answer, nonblocking or not
+		if ((c->ckpt = resume_range(c->fd, &c->head, c->out, &c->received)) < 0)
+		{
+			printf("connection %d: cannot resume %s\n", c->id, name);
+			finished++;
+			conn_close(epfd, c);
+			return;
+		}
+		c->checkpointed = c->received;
+	}
+	if (c->received == (long)c->head.size)
+		conn_received(epfd, c);
+}
+
+// One read per wakeup so a fast sender cannot starve the others; whatever is left wakes us
+// again (level triggered). With -F the header said how much to take; otherwise the file ends
+// with the chunk whose last byte is '\0'.
+void conn_read(int epfd, struct conn_so *c)
+{
+	static char buf[EV_READ];
+	long n, max = EV_READ;
+	int end = 0;
+
+	if (framed && (long)c->head.size - c->received < max)
+		max = c->head.size - c->received;
+	if (use_splice)
+		n = splice_chunk(c->fd, c->out, framed ? (long)c->head.size - c->received : SPLICE_LEN,
+			&c->received, framed ? NULL : &end);
+	else
+		n = recv(c->fd, buf, max, 0);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n <= 0)
+	{
+		if (n == 0)
+			printf("connection %d closed after %ld bytes, before the end of the file\n", c->id, c->received);
+		else
+			printf("error receiving myTCPreceive-%d.txt: %s\n", c->id, strerror(errno));
+		finished++;
+		conn_close(epfd, c);
+		return;
+	}
+	if (!use_splice)
+	{
+		if (!framed && buf[n-1] == '\0')                            //if it is the end of the file
+		{
+			end = 1;
+			n--;
+		}
+		if (n > 0 && write(c->out, buf, n) != n)
+		{
+			printf("error writing myTCPreceive-%d.txt\n", c->id);
+			finished++;
+			conn_close(epfd, c);
+			return;
+		}
+		c->received += n;
+	}
+	if (c->ckpt >= 0 && c->received - c->checkpointed >= CHECKPOINT_BYTES)
+	{
+		checkpoint(c->ckpt, c->out, &c->head, c->received);
+		c->checkpointed = c->received;
+	}
+	if (end || (framed && c->received == (long)c->head.size))
+		conn_received(epfd, c);
+}
+
+// The whole file is in: answer when the socket can take it
+void conn_received(int epfd, struct conn_so *c)
+{
+	struct epoll_event ev;
+
+	if (c->ckpt >= 0)                                               //the ack says the range is durable
+	{
+		checkpoint(c->ckpt, c->out, &c->head, c->received);
+		c->checkpointed = c->received;
+	}
+	c->state = CONN_ACK;
+	ev.events = EPOLLOUT;
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	conn_ack(epfd, c);                                              //the socket is almost surely writable already
+}
+
+void conn_ack(int epfd, struct conn_so *c)
+{
+	struct ack_so ack;
+
+	ack.num = 1;
+	ack.len = 0;
+	if (send(c->fd, &ack, 2, MSG_NOSIGNAL) < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR)
+			return;                                                 //EPOLLOUT tells us when to try again
+		printf("send error on connection %d\n", c->id);
+	}
+	else
+		printf("a file has been successfully received!\nthe total data received is %ld bytes (myTCPreceive-%d.txt)\n", c->received, c->id);
+	finished++;
+	conn_close(epfd, c);
+}
+
+void conn_close(int epfd, struct conn_so *c)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	if (c->ckpt >= 0)
+	{
+		if (c->received > c->checkpointed)                          //cut off: keep what did arrive
+			checkpoint(c->ckpt, c->out, &c->head, c->received);
+		close(c->ckpt);
+	}
+	close(c->fd);
+	close(c->out);
+	free(c);
+	live--;
 }
 
 void str_ser(int sockfd)
@@ -108,5 +451,251 @@ void str_ser(int sockfd)
 	}
 	fwrite (buf , 1 , lseek , fp);					//write data into file
 	fclose(fp);
-	printf("a file has been successfully received!\nthe total data received is %d bytes\n", (int)lseek);
+	printf("a file has been successfully received!\nthe total data received is %ld bytes\n", lseek);
+}
+
+// str_ser for -z: the data goes socket -> pipe -> file inside the kernel, so there is no
+// buffer to overflow and the file can be as large as the disk allows
+void str_ser_splice(int sockfd)
+{
+	struct ack_so ack;
+	int out, end = 0;
+	long n, lseek = 0;
+
+	printf("receiving data!\n");
+	if ((out = open("myTCPreceive.txt", SPLICEFILE, 0644)) < 0)
+	{
+		printf("File doesn't exit\n");
+		exit(0);
+	}
+	while (!end)
+	{
+		n = splice_chunk(sockfd, out, SPLICE_LEN, &lseek, &end);
+		if (n <= 0)
+		{
+			printf("error when receiving\n");
+			exit(1);
+		}
+	}
+	close(out);
+	ack.num = 1;
+	ack.len = 0;
+	if ((n = send(sockfd, &ack, 2, 0))==-1)
+	{
+			printf("send error!");								//send the ack
+			exit(1);
+	}
+	printf("a file has been successfully received!\nthe total data received is %ld bytes\n", lseek);
+}
+
+// Move what the socket has (up to max, at most SPLICE_LEN) to the end of out through a pipe.
+// With end set, only the last byte comes back to user space: if it is the end byte it is cut
+// off the file and *end is set; -F passes NULL, the header already said where the file ends.
+// Returns the bytes taken from the socket, 0 at EOF, -1 on error (EAGAIN on a nonblocking
+// socket with nothing to read). The pipe is empty again on return, so one is enough for
+// every connection of the event loop.
+long splice_chunk(int sockfd, int out, long max, long *offset, int *end)
+{
+	static int pipefd[2] = {-1, -1};
+	ssize_t n, m, moved;
+	char last;
+
+	if (pipefd[0] < 0)
+	{
+		if (pipe(pipefd) < 0)
+			return -1;
+		fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_LEN);                   //fails quietly above pipe-max-size
+	}
+	n = splice(sockfd, NULL, pipefd[1], NULL, max < SPLICE_LEN ? max : SPLICE_LEN, SPLICE_F_MOVE);
+	if (n <= 0)
+		return n;
+	for (moved = 0; moved < n; moved += m)
+	{
+		m = splice(pipefd[0], NULL, out, NULL, n - moved, SPLICE_F_MOVE);
+		if (m <= 0)
+		{
+			close(pipefd[0]);                                        //whatever is left in the pipe is lost
+			close(pipefd[1]);
+			pipefd[0] = pipefd[1] = -1;
+			return -1;
+		}
+	}
+	*offset += n;
+	if (end != NULL && pread(out, &last, 1, *offset - 1) == 1 && last == '\0')   //if it is the end of the file
+	{
+		*end = 1;
+		(*offset)--;
+		if (ftruncate(out, *offset) < 0)
+			return -1;
+	}
+	return n;
+}
+
+// -F in a forked child: the header says how many bytes follow, so the data can be taken in
+// FRAME_BLOCK pieces with MSG_WAITALL (or spliced) and no byte of it has to be inspected
+void str_ser_framed(int sockfd)
+{
+	struct head_so head;
+	struct ack_so ack;
+	char *buf = NULL, name[32];
+	long n, want, lseek = 0, checkpointed;
+	int out, ckpt = -1;
+
+	printf("receiving data!\n");
+	if (recv(sockfd, &head, sizeof(head), MSG_WAITALL) != sizeof(head) || check_head(&head) < 0)
+	{
+		printf("not a framed upload\n");
+		exit(1);
+	}
+	printf("file %s, %lu bytes\n", head.name, (unsigned long)head.size);
+	if (head.streams > 1 || head.resume)
+		out = open_range(&head, name);
+	else
+		out = open(strcpy(name, "myTCPreceive.txt"), use_splice ? SPLICEFILE : NEWFILE, 0644);
+	if (out < 0)
+	{
+		printf("File doesn't exit\n");
+		exit(0);
+	}
+	if (head.resume && (ckpt = resume_range(sockfd, &head, out, &lseek)) < 0)
+	{
+		printf("cannot resume %s\n", name);
+		exit(1);
+	}
+	checkpointed = lseek;
+	if (!use_splice && (buf = malloc(FRAME_BLOCK)) == NULL)
+		exit(2);
+	while (lseek < (long)head.size)
+	{
+		want = (long)head.size - lseek;
+		if (use_splice)
+			n = splice_chunk(sockfd, out, want, &lseek, NULL);
+		else
+		{
+			n = recv(sockfd, buf, want < FRAME_BLOCK ? want : FRAME_BLOCK, MSG_WAITALL);
+			if (n > 0 && write(out, buf, n) != n)
+				n = -1;
+			if (n > 0)
+				lseek += n;
+		}
+		if (n <= 0)
+		{
+			printf("error when receiving\n");
+			if (ckpt >= 0)                                          //cut off: keep what did arrive
+				checkpoint(ckpt, out, &head, lseek);
+			exit(1);
+		}
+		if (ckpt >= 0 && lseek - checkpointed >= CHECKPOINT_BYTES)
+		{
+			checkpoint(ckpt, out, &head, lseek);
+			checkpointed = lseek;
+		}
+	}
+	if (ckpt >= 0)                                                  //the ack says the range is durable
+	{
+		checkpoint(ckpt, out, &head, lseek);
+		close(ckpt);
+	}
+	close(out);
+	free(buf);
+	ack.num = 1;
+	ack.len = 0;
+	if ((n = send(sockfd, &ack, 2, 0))==-1)
+	{
+			printf("send error!");								//send the ack
+			exit(1);
+	}
+	printf("a file has been successfully received!\nthe total data received is %ld bytes (%s)\n", lseek, name);
+}
+
+// Returns -1 unless head is a header this server understands
+int check_head(struct head_so *head)
+{
+	if (head->magic != HEAD_MAGIC || head->version != HEAD_VERSION)
+		return -1;
+	if (head->streams > MAXSTREAMS || head->stream >= head->streams || head->offset + head->size > head->total)
+		return -1;
+	head->name[HEAD_NAMELEN-1] = '\0';
+	return 0;
+}
+
+// One stream of a -S upload: its range goes at its offset in the file every stream of the
+// upload shares, myTCPreceive-<upload>.txt, which is created by whichever stream comes first
+// and never truncated. The descriptor is left at the offset, so plain writes and splice land
+// there. name gets the file name.
+int open_range(struct head_so *head, char *name)
+{
+	int out;
+
+	sprintf(name, "myTCPreceive-%08x.txt", head->upload);
+	if ((out = open(name, RANGEFILE, 0644)) < 0)
+		return -1;
+	if (lseek(out, head->offset, SEEK_SET) < 0)
+	{
+		close(out);
+		return -1;
+	}
+	printf("stream %d of %d: %lu bytes at offset %lu of %s\n", head->stream, head->streams,
+		(unsigned long)head->size, (unsigned long)head->offset, name);
+	return out;
+}
+
+// -r: the upload's checkpoint file, myTCPreceive-<upload>.ckpt, has a ckpt_so for each of its
+// streams saying how much of the range is durably in the file. The client is told that much
+// as a uint64_t, *skip gets it and out is moved past it. Returns the checkpoint file, -1 on error.
+int resume_range(int sockfd, struct head_so *head, int out, long *skip)
+{
+	struct ckpt_so slot;
+	uint64_t done = 0;
+	char name[32];
+	int ckpt;
+
+	sprintf(name, "myTCPreceive-%08x.ckpt", head->upload);
+	if ((ckpt = open(name, CKPTFILE, 0644)) < 0)
+		return -1;
+	if (pread(ckpt, &slot, sizeof(slot), head->stream * sizeof(slot)) == sizeof(slot) && slot.magic == CKPT_MAGIC &&
+		slot.streams == head->streams && slot.offset == head->offset && slot.size == head->size && slot.done <= slot.size)
+		done = slot.done;
+	if (lseek(out, head->offset + done, SEEK_SET) < 0 || send(sockfd, &done, sizeof(done), MSG_NOSIGNAL) != sizeof(done))
+	{
+		close(ckpt);
+		return -1;
+	}
+	if (done > 0)
+		printf("stream %d: %lu bytes were stored already, resuming at offset %lu\n", head->stream,
+			(unsigned long)done, (unsigned long)(head->offset + done));
+	*skip = done;
+	return ckpt;
+}
+
+// -r: the first done bytes of the range are written. They are made durable before the slot
+// says so, and the slot before anyone relies on it, so a crash can lose data but never claim
+// it. Once every stream's slot says complete the upload needs no checkpoint any more.
+void checkpoint(int ckpt, int out, struct head_so *head, long done)
+{
+	struct ckpt_so slot, slots[MAXSTREAMS];
+	char name[32];
+	int i, n;
+
+	if (fdatasync(out) < 0)
+		return;
+	slot.magic = CKPT_MAGIC;
+	slot.streams = head->streams;
+	slot.offset = head->offset;
+	slot.size = head->size;
+	slot.done = done;
+	if (pwrite(ckpt, &slot, sizeof(slot), head->stream * sizeof(slot)) != sizeof(slot) || fdatasync(ckpt) < 0)
+		return;
+	if (done < (long)head->size)
+		return;
+	if ((n = pread(ckpt, slots, head->streams * sizeof(slot), 0)) < 0)
+		return;
+	for (i = 0; i < n / (int)sizeof(slot); i++)
+		if (slots[i].magic != CKPT_MAGIC || slots[i].streams != head->streams || slots[i].done != slots[i].size)
+			break;
+	if (i < head->streams)
+		return;
+	sprintf(name, "myTCPreceive-%08x.ckpt", head->upload);
+	unlink(name);
+	printf("upload %08x is complete\n", head->upload);
 }
@@ -0,0 +1,112 @@
+// Per-phase transfer timing with nanosecond resolution. Time is read from the TSC when the CPU
+// has an invariant one (one instruction, no syscall), otherwise from CLOCK_MONOTONIC; either
+// never steps with the wall clock. TSC ticks are turned into nanoseconds with the rate measured
+// against CLOCK_MONOTONIC over the run itself, so there is no calibration delay at startup.
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+// load: making the file addressable. first byte: from the start of the transfer (the hello,
+// if any) until the first data is handed to the kernel. steady: sending the rest. ack wait:
+// blocked until acknowledgements arrive. teardown: from the last ACK until everything is
+// released. The transfer time is first byte + steady + ack wait.
+enum {PH_LOAD, PH_FIRST, PH_STEADY, PH_ACK_WAIT, PH_TEARDOWN, PH_COUNT};
+
+struct timing_so
+{
+bool tsc;					// ticks are TSC cycles, not nanoseconds
+uint64_t t0, t0_ns;			// both clocks when timing started, to measure the TSC rate
+uint64_t mark;				// when the current phase began (ticks)
+int phase;					// PH_*, or -1 while nothing is timed
+uint64_t ticks[PH_COUNT];	// time spent in each phase
+};
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t timing_now(struct timing_so *t)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (t->tsc)
+        return __rdtsc();
+#endif
+    return mono_ns();
+}
+
+static void timing_init(struct timing_so *t)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+#endif
+    int i;
+
+    t->tsc = false;
+#if defined(__x86_64__) || defined(__i386__)
+    // CPUID 0x80000007 EDX bit 8: the TSC ticks at a constant rate in every power state
+    t->tsc = __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1 << 8));
+#endif
+    for (i = 0; i < PH_COUNT; i++)
+        t->ticks[i] = 0;
+    t->phase = -1;
+    t->t0_ns = mono_ns();
+    t->t0 = timing_now(t);
+}
+
+// End the current phase, if any, and start phase (-1 = stop)
+static inline void timing_phase(struct timing_so *t, int phase)
+{
+    uint64_t now = timing_now(t);
+
+    if (t->phase >= 0)
+        t->ticks[t->phase] += now - t->mark;
+    t->mark = now;
+    t->phase = phase;
+}
+
+// The first data has been handed to the kernel: the first-byte phase is over
+static inline void timing_sent(struct timing_so *t)
+{
+    if (t->phase == PH_FIRST)
+        timing_phase(t, PH_STEADY);
+}
+
+static double timing_ms(struct timing_so *t, int phase)
+{
+    double ns_per_tick = 1.0;
+    uint64_t now;
+
+    if (t->tsc)
+    {
+        now = timing_now(t);
+        if (now > t->t0)
+            ns_per_tick = (double)(mono_ns() - t->t0_ns) / (now - t->t0);
+    }
+    return t->ticks[phase] * ns_per_tick / 1e6;
+}
+
+static double timing_transfer_ms(struct timing_so *t)
+{
+    return timing_ms(t, PH_FIRST) + timing_ms(t, PH_STEADY) + timing_ms(t, PH_ACK_WAIT);
+}
+
+static void timing_print(struct timing_so *t)
+{
+    printf("Phases(ms, %s): load %.6f, first byte %.6f, steady %.6f, ack wait %.6f, teardown %.6f\n",
+           t->tsc ? "tsc" : "monotonic", timing_ms(t, PH_LOAD), timing_ms(t, PH_FIRST), timing_ms(t, PH_STEADY),
+           timing_ms(t, PH_ACK_WAIT), timing_ms(t, PH_TEARDOWN));
+}
+
+#endif
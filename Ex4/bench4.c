@@ -0,0 +1,591 @@
+#include "headsock.h"
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Benchmark driver for udp_client4 / udp_ser4: starts the server (and optionally udp_proxy4)
+// once and waits for its readiness byte instead of sleeping, then for every combination of
+// file size, payload size and window runs warmup transfers followed by measured ones, checks
+// every received file against the sent one, and writes the statistics as JSON or CSV.
+// Exits 1 when any transfer failed or arrived damaged, so a pipeline can gate on it.
+
+#define MAXSWEEP 32  // values per swept parameter
+#define MAXARGS 64  // words in an extra argument string
+#define MAXITER 10000  // measured runs per combination
+
+struct run_so			//what one client run reported on its -R descriptor
+{
+unsigned session;
+double time_ms;
+long bytes;
+int datalen;
+long packets;
+long send_calls;
+long ack_calls;
+double load_ms;
+};
+
+struct stats_so			//summary of the measured runs of one metric
+{
+double mean, stdev, min, max;
+double p50, p90, p99;
+double ci_lo, ci_hi;		// 95% confidence interval of the mean
+};
+
+long sizes[MAXSWEEP] = {512000};  // -s: file sizes swept
+int nsizes = 1;
+long payloads[MAXSWEEP] = {0};  // -p: payload sizes swept (0 = the client's default)
+int npayloads = 1;
+long windows[MAXSWEEP] = {0};  // -w: selective-repeat windows swept (0 = batch mode)
+int nwindows = 1;
+int iterations = 10;  // -i: measured runs per combination
+int warmup = 2;  // -W: discarded runs before them
+int timeout_s = 60;  // -t: a run that takes longer counts as failed
+bool csv = false;  // -f csv instead of json
+char *client_extra = "", *server_extra = "", *link_args = NULL;  // -e, -S, -l
+char bindir[PATH_MAX] = ".";  // -b: where the compiled programs are
+char workdir[PATH_MAX];  // scratch directory the transfers run in
+pid_t server_pid = -1, proxy_pid = -1;
+bool keep = false;  // leave the scratch directory and its logs behind for a look
+
+int parse_list(char *arg, long *list);
+int split_args(char *s, char **argv, int max);
+pid_t start_ready(char *program, char *extra, char *ready_flag, const char *log);
+int run_client(long payload, long window, struct run_so *run);
+bool check_file(unsigned session, const char *sent);
+void make_file(const char *path, long size);
+void summarize(double *v, int n, struct stats_so *st);
+double t95(int df);
+int cmp_double(const void *a, const void *b);
+void print_stats(FILE *out, const char *name, struct stats_so *st, double *v, int n);
+void print_string(FILE *out, const char *s);
+void stop_child(pid_t pid);
+void cleanup(void);
+void on_signal(int sig);
+long now_us(void);
+
+int main(int argc, char *argv[])
+{
+    int opt, si, pi, wi, i, n, failed, total_failed = 0;
+    char *out_name = NULL, real[PATH_MAX];
+    FILE *out = stdout;
+    bool first = true;
+    struct run_so run;
+    struct stats_so st;
+    static double times[MAXITER], rates[MAXITER];
+    double packets, calls;
+
+    while ((opt = getopt(argc, argv, "s:p:w:i:W:t:f:o:e:S:l:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                nsizes = parse_list(optarg, sizes);
+                break;
+            case 'p':
+                npayloads = parse_list(optarg, payloads);
+                break;
+            case 'w':
+                nwindows = parse_list(optarg, windows);
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            case 'W':
+                warmup = atoi(optarg);
+                break;
+            case 't':
+                timeout_s = atoi(optarg);
+                break;
+            case 'f':
+                csv = strcmp(optarg, "csv") == 0;
+                if (!csv && strcmp(optarg, "json") != 0)
+                {
+                    printf("Unknown output format %s\n", optarg);
+                    exit(2);
+                }
+                break;
+            case 'o':
+                out_name = optarg;
+                break;
+            case 'e':
+                client_extra = optarg;
+                break;
+            case 'S':
+                server_extra = optarg;
+                break;
+            case 'l':
+                link_args = optarg;
+                break;
+            case 'b':
+                strncpy(bindir, optarg, sizeof(bindir) - 1);
+                break;
+            default:
+                printf("Usage: %s [-s sizes] [-p payloads] [-w windows] [-i iterations] [-W warmup] [-t timeout s]"
+                       " [-f json|csv] [-o output] [-e client args] [-S server args] [-l proxy args] [-b bindir]\n"
+                       "lists are comma separated, sizes take K and M suffixes, window 0 = batch mode\n", argv[0]);
+                exit(2);
+        }
+    }
+    if (nsizes < 1 || npayloads < 1 || nwindows < 1 || iterations < 1 || iterations > MAXITER || warmup < 0)
+    {
+        printf("Bad sweep or iteration count\n");
+        exit(2);
+    }
+    if (realpath(bindir, real) == NULL)
+    {
+        printf("No directory %s\n", bindir);
+        exit(2);
+    }
+    strcpy(bindir, real);
+    if (out_name != NULL && (out = fopen(out_name, "w")) == NULL)
+    {
+        printf("Cannot write %s\n", out_name);
+        exit(2);
+    }
+
+    // The programs read and write their files in the working directory, so give them one of
+    // their own; a server that outlived us would still be bound, so it goes down on any exit
+    snprintf(workdir, sizeof(workdir), "/tmp/bench4XXXXXX");
+    if (mkdtemp(workdir) == NULL || chdir(workdir) == -1)
+    {
+        printf("Cannot make a scratch directory\n");
+        exit(2);
+    }
+    atexit(cleanup);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    server_pid = start_ready("udp_ser4", server_extra, "-r", "server.log");
+    if (link_args != NULL)
+    {
+        proxy_pid = start_ready("udp_proxy4", link_args, "-R", "proxy.log");
+    }
+    fprintf(stderr, "bench4: server ready, %d warmup and %d measured runs per combination\n", warmup, iterations);
+
+    if (csv)
+    {
+        fprintf(out, "file_size,payload,window,runs,failed,metric,mean,stdev,min,max,p50,p90,p99,ci95_lo,ci95_hi\n");
+    }
+    else
+    {
+        fprintf(out, "{\n  \"tool\": \"bench4\",\n  \"iterations\": %d,\n  \"warmup\": %d,\n", iterations, warmup);
+        fprintf(out, "  \"client_args\": ");
+        print_string(out, client_extra);
+        fprintf(out, ",\n  \"server_args\": ");
+        print_string(out, server_extra);
+        fprintf(out, ",\n  \"link\": ");
+        print_string(out, link_args ? link_args : "");
+        fprintf(out, ",\n  \"results\": [");
+    }
+    for (si = 0; si < nsizes; si++)
+    {
+        make_file("bigfile.bin", sizes[si]);
+        for (pi = 0; pi < npayloads; pi++)
+        {
+            for (wi = 0; wi < nwindows; wi++)
+            {
+                n = failed = 0;
+                packets = calls = 0;
+                for (i = 0; i < warmup + iterations; i++)
+                {
+                    if (run_client(payloads[pi], windows[wi], &run) == -1 || !check_file(run.session, "bigfile.bin"))
+                    {
+                        failed++;
+                        continue;
+                    }
+                    if (i < warmup)
+                        continue;
+                    times[n] = run.time_ms;
+                    rates[n] = run.bytes * 8 / (run.time_ms * 1000);  // Mbit/s
+                    packets += run.packets;
+                    calls += run.send_calls;
+                    n++;
+                }
+                total_failed += failed;
+                fprintf(stderr, "bench4: size %ld payload %ld window %ld: %d runs, %d failed\n",
+                        sizes[si], payloads[pi], windows[wi], n, failed);
+                if (csv)
+                {
+                    summarize(times, n, &st);
+                    fprintf(out, "%ld,%ld,%ld,%d,%d,time_ms,", sizes[si], payloads[pi], windows[wi], n, failed);
+                    print_stats(out, NULL, &st, NULL, 0);
+                    summarize(rates, n, &st);
+                    fprintf(out, "%ld,%ld,%ld,%d,%d,goodput_mbps,", sizes[si], payloads[pi], windows[wi], n, failed);
+                    print_stats(out, NULL, &st, NULL, 0);
+                    continue;
+                }
+                fprintf(out, "%s\n    {\"file_size\": %ld, \"payload\": %ld, \"window\": %ld, \"runs\": %d, \"failed\": %d,\n",
+                        first ? "" : ",", sizes[si], payloads[pi], windows[wi], n, failed);
+                fprintf(out, "     \"packets\": %.1f, \"send_calls\": %.1f,\n", n ? packets / n : 0.0, n ? calls / n : 0.0);
+                summarize(times, n, &st);
+                print_stats(out, "time_ms", &st, times, n);
+                fprintf(out, ",\n");
+                summarize(rates, n, &st);
+                print_stats(out, "goodput_mbps", &st, rates, n);
+                fprintf(out, "}");
+                first = false;
+                fflush(out);
+            }
+        }
+    }
+    if (!csv)
+    {
+        fprintf(out, "\n  ],\n  \"failed\": %d\n}\n", total_failed);
+    }
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    if (total_failed > 0)
+    {
+        keep = true;
+        fprintf(stderr, "bench4: %d runs failed, logs of the last one in %s\n", total_failed, workdir);
+    }
+    exit(total_failed > 0 ? 1 : 0);
+}
+
+// "64K,512000,4M" into list; returns how many values
+int parse_list(char *arg, long *list)
+{
+    char *s = strdup(arg), *tok, *end, *save;
+    int n = 0;
+
+    for (tok = strtok_r(s, ",", &save); tok != NULL && n < MAXSWEEP; tok = strtok_r(NULL, ",", &save))
+    {
+        list[n] = strtol(tok, &end, 10);
+        if (*end == 'K' || *end == 'k')
+            list[n] *= 1024;
+        else if (*end == 'M' || *end == 'm')
+            list[n] *= 1024 * 1024;
+        n++;
+    }
+    free(s);
+    return n;
+}
+
+// Split a string of space-separated words into argv; returns how many
+int split_args(char *s, char **argv, int max)
+{
+    char *copy = strdup(s), *tok, *save;
+    int n = 0;
+
+    for (tok = strtok_r(copy, " ", &save); tok != NULL && n < max; tok = strtok_r(NULL, " ", &save))
+    {
+        argv[n++] = tok;
+    }
+    return n;
+}
+
+// Start a long-running program with a pipe on its ready_flag option and wait until it writes
+// the byte that says its socket is bound; its output goes to log
+pid_t start_ready(char *program, char *extra, char *ready_flag, const char *log)
+{
+    char *argv[MAXARGS + 4], path[PATH_MAX + 32], fdstr[16], c;
+    int p[2], n, fd;
+    struct pollfd pfd;
+    pid_t pid;
+
+    snprintf(path, sizeof(path), "%s/%s", bindir, program);
+    if (pipe(p) == -1)
+    {
+        printf("error in pipe\n");
+        exit(2);
+    }
+    argv[0] = path;
+    n = 1 + split_args(extra, argv + 1, MAXARGS);
+    snprintf(fdstr, sizeof(fdstr), "%d", p[1]);
+    argv[n++] = ready_flag;
+    argv[n++] = fdstr;
+    argv[n] = NULL;
+    pid = fork();
+    if (pid == 0)
+    {
+        close(p[0]);
+        fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        execv(path, argv);
+        _exit(127);
+    }
+    close(p[1]);
+    pfd.fd = p[0];
+    pfd.events = POLLIN;
+    if (pid == -1 || poll(&pfd, 1, 10000) != 1 || read(p[0], &c, 1) != 1)
+    {
+        // EOF without the byte: it exited (or never started) before binding
+        printf("%s did not come up, see %s/%s\n", program, workdir, log);
+        keep = true;
+        exit(2);
+    }
+    close(p[0]);
+    return pid;
+}
+
+// One transfer of bigfile.bin; fills run from the line the client writes on its -R pipe.
+// Returns -1 when the client failed or timed out.
+int run_client(long payload, long window, struct run_so *run)
+{
+    char *argv[MAXARGS + 16], path[PATH_MAX + 32], fdstr[16], pstr[24], wstr[24], line[512];
+    int p[2], n = 0, got = 0, status, r, fd;
+    struct pollfd pfd;
+    long deadline = now_us() / 1000 + timeout_s * 1000L, left;
+    pid_t pid;
+
+    snprintf(path, sizeof(path), "%s/udp_client4", bindir);
+    if (pipe(p) == -1)
+        return -1;
+    argv[n++] = path;
+    if (payload > 0)
+    {
+        snprintf(pstr, sizeof(pstr), "%ld", payload);
+        argv[n++] = "-p";
+        argv[n++] = pstr;
+    }
+    if (window > 0)
+    {
+        snprintf(wstr, sizeof(wstr), "%ld", window);
+        argv[n++] = "-w";
+        argv[n++] = wstr;
+    }
+    if (link_args != NULL)
+    {
+        argv[n++] = "-P";
+        argv[n++] = "5351";
+    }
+    n += split_args(client_extra, argv + n, MAXARGS);
+    snprintf(fdstr, sizeof(fdstr), "%d", p[1]);
+    argv[n++] = "-R";
+    argv[n++] = fdstr;
+    argv[n++] = "localhost";
+    argv[n] = NULL;
+
+    pid = fork();
+    if (pid == 0)
+    {
+        close(p[0]);
+        fd = open("client.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        execv(path, argv);
+        _exit(127);
+    }
+    close(p[1]);
+    if (pid == -1)
+    {
+        close(p[0]);
+        return -1;
+    }
+
+    // Read until the client closes the pipe by exiting, or the time is up
+    pfd.fd = p[0];
+    pfd.events = POLLIN;
+    while (got < (int)sizeof(line) - 1)
+    {
+        left = deadline - now_us() / 1000;
+        if (left <= 0 || poll(&pfd, 1, left) != 1)
+        {
+            kill(pid, SIGKILL);
+            break;
+        }
+        r = read(p[0], line + got, sizeof(line) - 1 - got);
+        if (r <= 0)
+            break;
+        got += r;
+    }
+    line[got] = '\0';
+    close(p[0]);
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    if (sscanf(line, "session=%x time_ms=%lf bytes=%ld datalen=%d packets=%ld send_calls=%ld ack_calls=%ld load_ms=%lf",
+               &run->session, &run->time_ms, &run->bytes, &run->datalen, &run->packets, &run->send_calls,
+               &run->ack_calls, &run->load_ms) != 8 || run->time_ms <= 0)
+        return -1;
+    return 0;
+}
+
+// Compare the server's copy with what was sent, then remove it. The server may still be
+// finishing the file when the client has its last ACK (with -u the last writes complete
+// asynchronously), so a mismatch is retried for a moment before it counts.
+bool check_file(unsigned session, const char *sent)
+{
+    char name[64];
+    static char a[1 << 16], b[1 << 16];
+    FILE *fa, *fb;
+    size_t na, nb;
+    bool same = false;
+    int tries;
+
+    snprintf(name, sizeof(name), "bigfilereceive-%08x.bin", session);
+    for (tries = 0; tries < 200 && !same; tries++)
+    {
+        if (tries > 0)
+            usleep(10000);
+        fa = fopen(sent, "rb");
+        fb = fopen(name, "rb");
+        if (fa != NULL && fb != NULL)
+        {
+            do
+            {
+                na = fread(a, 1, sizeof(a), fa);
+                nb = fread(b, 1, sizeof(b), fb);
+            } while (na == nb && na > 0 && memcmp(a, b, na) == 0);
+            same = na == 0 && nb == 0;
+        }
+        if (fa != NULL)
+            fclose(fa);
+        if (fb != NULL)
+            fclose(fb);
+    }
+    unlink(name);
+    return same;
+}
+
+void make_file(const char *path, long size)
+{
+    static char buf[1 << 16];
+    FILE *in = fopen("/dev/urandom", "rb"), *out = fopen(path, "wb");
+    long n;
+
+    if (in == NULL || out == NULL)
+    {
+        printf("Cannot make %s\n", path);
+        exit(2);
+    }
+    for (; size > 0; size -= n)
+    {
+        n = size < (long)sizeof(buf) ? size : (long)sizeof(buf);
+        if (fread(buf, 1, n, in) != (size_t)n || fwrite(buf, 1, n, out) != (size_t)n)
+        {
+            printf("Cannot make %s\n", path);
+            exit(2);
+        }
+    }
+    fclose(in);
+    fclose(out);
+}
+
+// Mean, spread, nearest-rank percentiles and a Student-t 95% interval for the mean
+void summarize(double *v, int n, struct stats_so *st)
+{
+    double s[MAXITER], sum = 0, sq = 0, half;
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    if (n == 0)
+        return;
+    memcpy(s, v, n * sizeof(double));
+    qsort(s, n, sizeof(double), cmp_double);
+    for (i = 0; i < n; i++)
+        sum += s[i];
+    st->mean = sum / n;
+    for (i = 0; i < n; i++)
+        sq += (s[i] - st->mean) * (s[i] - st->mean);
+    st->stdev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+    st->min = s[0];
+    st->max = s[n - 1];
+    st->p50 = s[(int)ceil(0.50 * n) - 1];
+    st->p90 = s[(int)ceil(0.90 * n) - 1];
+    st->p99 = s[(int)ceil(0.99 * n) - 1];
+    half = n > 1 ? t95(n - 1) * st->stdev / sqrt(n) : 0;
+    st->ci_lo = st->mean - half;
+    st->ci_hi = st->mean + half;
+}
+
+// Two-sided 95% quantile of Student's t with df degrees of freedom
+double t95(int df)
+{
+    static const double t[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                               2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                               2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+    if (df <= 30)
+        return t[df - 1];
+    return df <= 60 ? 2.000 : df <= 120 ? 1.980 : 1.960;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// One metric: a JSON object with its samples, or the numbers of a CSV row when name is NULL
+void print_stats(FILE *out, const char *name, struct stats_so *st, double *v, int n)
+{
+    int i;
+
+    if (name == NULL)
+    {
+        fprintf(out, "%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", st->mean, st->stdev, st->min, st->max,
+                st->p50, st->p90, st->p99, st->ci_lo, st->ci_hi);
+        return;
+    }
+    fprintf(out, "     \"%s\": {\"mean\": %.4f, \"stdev\": %.4f, \"min\": %.4f, \"max\": %.4f, "
+            "\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"ci95\": [%.4f, %.4f],\n       \"samples\": [",
+            name, st->mean, st->stdev, st->min, st->max, st->p50, st->p90, st->p99, st->ci_lo, st->ci_hi);
+    for (i = 0; i < n; i++)
+        fprintf(out, "%s%.4f", i ? ", " : "", v[i]);
+    fprintf(out, "]}");
+}
+
+// A JSON string: quoted, with quotes, backslashes and control characters escaped
+void print_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+// udp_ser4 -w passes the SIGTERM on to its workers and waits for them
+void stop_child(pid_t pid)
+{
+    if (pid > 0)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+// Stop the server and proxy and remove the scratch directory
+void cleanup(void)
+{
+    char cmd[PATH_MAX + 16];
+
+    stop_child(proxy_pid);
+    stop_child(server_pid);
+    proxy_pid = server_pid = -1;
+    if (!keep)
+    {
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", workdir);
+        system(cmd);
+    }
+}
+
+void on_signal(int sig)
+{
+    (void)sig;
+    exit(2);
+}
+
+long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
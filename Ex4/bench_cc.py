@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""
+Compare the congestion controllers of udp_client4 (-c) in batch and selective-repeat
+mode. Each run's window log (-l) is kept in --log-dir as <mode>-<controller>.log,
+one "time_us cwnd ssthresh" line per change, ready to plot.
+"""
+
+import argparse
+import os
+
+from benchlib import Scratch, compile_programs, make_file, run_transfer, summarize
+
+CONTROLLERS = ("fixed", "reno", "vegas")
+
+
+def read_log(path):
+    """(time_us, cwnd) pairs of a window log"""
+    points = []
+    with open(path) as f:
+        for line in f:
+            t, cwnd, _ = line.split()
+            points.append((int(t), float(cwnd)))
+    return points
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--file-size", type=int, default=2 * 1024 * 1024)
+    parser.add_argument("--window", type=int, default=1024, help="selective-repeat window cap")
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--log-dir", default="cwnd_logs")
+    args = parser.parse_args()
+
+    os.makedirs(args.log_dir, exist_ok=True)
+    modes = [("batch", []), ("sr", ["-w", str(args.window)])]
+
+    with Scratch() as scratch:
+        programs = compile_programs(scratch)
+        make_file(os.path.join(scratch, "bigfile.bin"), args.file_size)
+        print(f"{'mode':>6} {'cc':>6} {'time ms':>9} {'MB/s':>8} {'peak cwnd':>10} {'final cwnd':>11}")
+        for mode, flags in modes:
+            for cc in CONTROLLERS:
+                log = os.path.abspath(os.path.join(args.log_dir, f"{mode}-{cc}.log"))
+                runs = []
+                for _ in range(args.iterations):
+                    result = run_transfer(programs, scratch, [], flags + ["-c", cc, "-l", log])
+                    if result and result["intact"]:
+                        runs.append(result)
+                if not runs:
+                    print(f"{mode:>6} {cc:>6}  all runs failed")
+                    continue
+                t = summarize([r["time_ms"] for r in runs])["mean"]
+                points = read_log(log)  # the last run's log
+                print(f"{mode:>6} {cc:>6} {t:>9.2f} {args.file_size / t / 1000:>8.2f} "
+                      f"{max(c for _, c in points):>10.0f} {points[-1][1]:>11.0f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,152 @@
+#include "headsock.h"
+#include "crc32c.h"
+
+// Microbenchmark of the CRC32C kernels in crc32c.h: for every buffer size each kernel hashes
+// the same random data repeatedly for about -t ms, and the best of -r rounds is reported in
+// GB/s. Every kernel must agree with the byte table and with the standard check value;
+// exits 1 if one does not.
+
+#define MAXSIZES 32  // buffer sizes measured
+
+long sizes[MAXSIZES] = {16, 64, 1472, 8192, 65536, 1048576, 16777216};  // -s
+int nsizes = 7;
+int rounds = 5;  // -r: rounds per kernel and size, the fastest counts
+int round_ms = 100;  // -t: how long one round runs
+
+double round_gbs(int kernel, const char *buf, long size, uint32_t *crc);
+long now_ns(void);
+
+int main(int argc, char **argv)
+{
+    static const int kernels[] = {CRC32C_BYTE, CRC32C_SLICE8, CRC32C_SSE42};
+    char *buf, *arg;
+    uint32_t crc, want;
+    double gbs, best;
+    int opt, i, k, r;
+    long max = 0;
+    bool bad = false;
+
+    while ((opt = getopt(argc, argv, "s:r:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                for (nsizes = 0, arg = strtok(optarg, ","); arg != NULL && nsizes < MAXSIZES; arg = strtok(NULL, ","))
+                {
+                    sizes[nsizes++] = atol(arg);
+                }
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 't':
+                round_ms = atoi(optarg);
+                break;
+            default:
+                printf("Usage: %s [-s size,size,...] [-r rounds] [-t ms per round]\n", argv[0]);
+                exit(1);
+        }
+    }
+    for (i = 0; i < nsizes; i++)
+    {
+        if (sizes[i] < 1)
+        {
+            printf("Sizes must be positive\n");
+            exit(1);
+        }
+        if (sizes[i] > max)
+        {
+            max = sizes[i];
+        }
+    }
+
+    crc32c_init();
+    printf("default kernel: %s\n", crc32c_name(crc32c_kernel));
+    for (k = 0; k < 3; k++)
+    {
+        if (kernels[k] == CRC32C_SSE42 && crc32c_kernel != CRC32C_SSE42)
+        {
+            continue;   // no SSE4.2 on this CPU
+        }
+        if (crc32c_with(kernels[k], 0, "123456789", 9) != 0xe3069283)
+        {
+            printf("%s: wrong check value\n", crc32c_name(kernels[k]));
+            bad = true;
+        }
+    }
+
+    // One byte more than the largest size, so an odd start exercises the unaligned head
+    buf = malloc(max + 1);
+    if (buf == NULL)
+    {
+        printf("Out of memory\n");
+        exit(2);
+    }
+    srand(1);
+    for (i = 0; i <= max; i++)
+    {
+        buf[i] = rand();
+    }
+
+    printf("%10s %14s %14s %14s\n", "bytes", "byte table", "slicing-by-8", "sse4.2");
+    for (i = 0; i < nsizes; i++)
+    {
+        want = crc32c_with(CRC32C_BYTE, 0, buf + 1, sizes[i]);
+        printf("%10ld", sizes[i]);
+        for (k = 0; k < 3; k++)
+        {
+            if (kernels[k] == CRC32C_SSE42 && crc32c_kernel != CRC32C_SSE42)
+            {
+                printf(" %14s", "-");
+                continue;
+            }
+            for (best = 0, r = 0; r < rounds; r++)
+            {
+                gbs = round_gbs(kernels[k], buf + 1, sizes[i], &crc);
+                if (gbs > best)
+                {
+                    best = gbs;
+                }
+            }
+            if (crc != want)
+            {
+                printf(" %14s", "MISMATCH");
+                bad = true;
+                continue;
+            }
+            printf(" %9.2f GB/s", best);
+        }
+        printf("\n");
+    }
+    free(buf);
+    exit(bad ? 1 : 0);
+}
+
+// Hash buf over and over for round_ms; the rate in GB/s, and the last result in *crc
+double round_gbs(int kernel, const char *buf, long size, uint32_t *crc)
+{
+    long start = now_ns(), end = start + round_ms * 1000000L, now, calls, i, n = 0;
+    volatile uint32_t sink;
+
+    // Check the clock only every so often, so that small sizes measure the kernel
+    calls = 1 + 65536 / size;
+    do
+    {
+        for (i = 0; i < calls; i++)
+        {
+            sink = crc32c_with(kernel, 0, buf, size);
+        }
+        n += calls;
+        now = now_ns();
+    } while (now < end);
+    *crc = sink;
+    return (double)n * size / (now - start);
+}
+
+long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
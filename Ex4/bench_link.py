@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Run udp_client4 -> udp_proxy4 -> udp_ser4 under emulated links instead of the
+zero-loss, microsecond-RTT loopback: each profile is a set of udp_proxy4 flags
+(loss and loss bursts, delay, jitter, reordering, duplication, a bandwidth cap).
+Every protocol mode is run over every profile; reports transfer time, goodput,
+retransmissions and what the link did to the packets. No netem or root needed.
+"""
+
+import argparse
+import os
+
+from benchlib import Scratch, compile_programs, make_file, run_transfer, summarize
+
+PROFILES = {
+    "lan": ["-d", "0.1"],
+    "wan": ["-d", "20", "-j", "2", "-B", "100"],
+    "lossy-wan": ["-d", "20", "-j", "2", "-B", "100", "-l", "0.01"],
+    "bursty": ["-d", "20", "-l", "0.02", "-b", "4"],
+    "reorder": ["-d", "5", "-j", "1", "-r", "0.05", "-D", "0.01"],
+    "narrow": ["-d", "10", "-B", "10", "-q", "65536"],
+}
+
+MODES = (
+    ("batch", []),
+    ("batch fec 8+2", ["-f", "8+2"]),
+    ("sr", ["-w", "256", "-m"]),
+)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--profiles", default=",".join(PROFILES),
+                        help="comma separated profiles: " + ", ".join(PROFILES))
+    parser.add_argument("--file-size", type=int, default=1024 * 1024)
+    parser.add_argument("--payload", type=int, default=1400)
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--timeout", type=int, default=300)
+    args = parser.parse_args()
+
+    with Scratch() as scratch:
+        programs = compile_programs(scratch, ("udp_ser4.c", "udp_client4.c", "udp_proxy4.c"))
+        make_file(os.path.join(scratch, "bigfile.bin"), args.file_size)
+        print(f"{'profile':>10} {'mode':>14} {'time ms':>9} {'MB/s':>7} {'sent':>7} {'lost':>6} "
+              f"{'q drops':>8} {'reord':>6} {'dups':>5} {'intact':>7}")
+        for profile in args.profiles.split(","):
+            for name, flags in MODES:
+                runs = []
+                for seed in range(args.iterations):
+                    # The same seed for every mode: each one meets the same losses
+                    link = PROFILES[profile] + ["-s", str(seed + 1)]
+                    result = run_transfer(programs, scratch, [], ["-p", str(args.payload)] + flags,
+                                          timeout=args.timeout, link=link)
+                    if result:
+                        runs.append(result)
+                if not runs:
+                    print(f"{profile:>10} {name:>14}  all runs failed")
+                    continue
+                t = summarize([r["time_ms"] for r in runs])["mean"]
+                up = [r["link"].get("client->server", {}) for r in runs]
+                total = {key: sum(u.get(key, 0) for u in up) / len(runs)
+                         for key in ("relayed", "lost", "dropped", "reordered", "duplicated")}
+                print(f"{profile:>10} {name:>14} {t:>9.1f} {args.file_size / t / 1000:>7.2f} "
+                      f"{summarize([r['send_pkts'] for r in runs])['mean']:>7.0f} {total['lost']:>6.0f} "
+                      f"{total['dropped']:>8.0f} {total['reordered']:>6.0f} {total['duplicated']:>5.0f} "
+                      f"{sum(r['intact'] for r in runs):>4}/{len(runs)}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+"""
+Compare the copying sender (malloc + fread + memcpy into pack_so) with the
+mmap/sendmsg sender (udp_client4 -z) for several file sizes.
+Reports time to make the file addressable, transfer time, throughput and memory.
+"""
+
+import argparse
+import os
+
+from benchlib import Scratch, compile_programs, make_file, run_transfer, summarize
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--sizes", default="524288,8388608,33554432",
+                        help="comma separated file sizes in bytes")
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--window", type=int, default=256)
+    args = parser.parse_args()
+
+    modes = [("copy", []), ("mmap", ["-z"])]
+    common = ["-m", "-w", str(args.window)]
+
+    with Scratch() as scratch:
+        programs = compile_programs(scratch)
+        print(f"{'size':>10} {'mode':>5} {'load ms':>9} {'time ms':>9} {'MB/s':>8} "
+              f"{'peak KB':>9} {'anon KB':>9}")
+        for size in [int(s) for s in args.sizes.split(",")]:
+            make_file(os.path.join(scratch, "bigfile.bin"), size)
+            for name, flags in modes:
+                runs = []
+                for _ in range(args.iterations):
+                    result = run_transfer(programs, scratch, ["-m"], common + flags)
+                    if result and result["intact"]:
+                        runs.append(result)
+                if not runs:
+                    print(f"{size:>10} {name:>5}  all runs failed")
+                    continue
+                load = summarize([r["load_ms"] for r in runs])["mean"]
+                t = summarize([r["time_ms"] for r in runs])["mean"]
+                peak = max(r["peak_rss_kb"] for r in runs)
+                anon = max(r["anon_rss_kb"] for r in runs)
+                print(f"{size:>10} {name:>5} {load:>9.3f} {t:>9.1f} {size / t / 1000:>8.2f} "
+                      f"{peak:>9.0f} {anon:>9.0f}")
+
+
+if __name__ == "__main__":
+    main()
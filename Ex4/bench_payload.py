@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+"""
+Sweep the negotiated payload size (udp_client4 -p) from tens of bytes up to the
+largest UDP datagram and report throughput and packets per second for each size.
+The selective-repeat window is scaled so every size keeps about the same number
+of bytes in flight.
+"""
+
+import argparse
+import os
+
+from benchlib import Scratch, compile_programs, make_file, run_transfer, summarize
+
+DEFAULT_SIZES = "32,64,100,256,512,1024,1400,4096,8192,9000,16384,32768,65487"  # 65487 = MAXDATALEN with the v2 header and checksum
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--sizes", default=DEFAULT_SIZES, help="comma separated payload sizes in bytes")
+    parser.add_argument("--file-size", type=int, default=4 * 1024 * 1024)
+    parser.add_argument("--window-bytes", type=int, default=1024 * 1024,
+                        help="bytes in flight; the window in packets is this divided by the payload size")
+    parser.add_argument("--iterations", type=int, default=3)
+    args = parser.parse_args()
+
+    with Scratch() as scratch:
+        programs = compile_programs(scratch)
+        make_file(os.path.join(scratch, "bigfile.bin"), args.file_size)
+        print(f"file size {args.file_size} bytes, about {args.window_bytes} bytes in flight")
+        print(f"{'payload':>8} {'window':>7} {'packets':>8} {'time ms':>9} {'MB/s':>9} {'pkts/s':>10} {'ok':>5}")
+        for payload in [int(s) for s in args.sizes.split(",")]:
+            window = max(4, min(1024, args.window_bytes // payload))
+            packets = (args.file_size + payload - 1) // payload
+            runs = []
+            for _ in range(args.iterations):
+                result = run_transfer(programs, scratch, ["-m"],
+                                      ["-m", "-z", "-w", str(window), "-p", str(payload)])
+                if result and result["intact"]:
+                    runs.append(result)
+            if not runs:
+                print(f"{payload:>8} {window:>7} {packets:>8}  all runs failed")
+                continue
+            t = summarize([r["time_ms"] for r in runs])["mean"]
+            print(f"{payload:>8} {window:>7} {packets:>8} {t:>9.2f} {args.file_size / t / 1000:>9.2f} "
+                  f"{packets / t * 1000:>10.0f} {len(runs):>2}/{args.iterations}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""
+Start one udp_ser4 and N udp_client4 uploads at the same time, for several N.
+Reports how long the whole group took, the aggregate throughput and how many of
+the received files are intact.
+"""
+
+import argparse
+import glob
+import os
+import subprocess
+import time
+
+from benchlib import Scratch, compile_programs, make_file, parse_client_output, start_ready
+
+DEFAULT_CLIENTS = "1,10,50,100,200"
+
+
+def run_group(programs, workdir, clients, client_args, timeout, server_args=("-m",)):
+    """Run clients uploads concurrently; returns (seconds, parsed client results, intact files)"""
+    for old in glob.glob(os.path.join(workdir, "bigfilereceive-*.bin")):
+        os.remove(old)
+    with open(os.path.join(workdir, "server.log"), "w") as server_log:
+        server = start_ready([programs["udp_ser4"], "-n", str(clients)] + list(server_args), "-r",
+                             cwd=workdir, stdout=server_log, stderr=subprocess.STDOUT)
+        if server is None:
+            raise RuntimeError("udp_ser4 did not start, see " + server_log.name)
+        start = time.monotonic()
+        logs, procs = [], []
+        for i in range(clients):
+            log = open(os.path.join(workdir, f"client{i}.log"), "w+")
+            logs.append(log)
+            procs.append(subprocess.Popen([programs["udp_client4"]] + client_args + ["localhost"],
+                                          cwd=workdir, stdout=log, stderr=subprocess.STDOUT))
+        for proc in procs:
+            try:
+                proc.wait(timeout=timeout)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+        elapsed = time.monotonic() - start
+        try:
+            server.wait(timeout=timeout)
+        except subprocess.TimeoutExpired:
+            server.kill()
+
+    results = []
+    for log in logs:
+        log.seek(0)
+        result = parse_client_output(log.read())
+        if result:
+            results.append(result)
+        log.close()
+    with open(os.path.join(workdir, "bigfile.bin"), "rb") as f:
+        original = f.read()
+    intact = 0
+    for received in glob.glob(os.path.join(workdir, "bigfilereceive-*.bin")):
+        with open(received, "rb") as f:
+            intact += f.read() == original
+    return elapsed, results, intact
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--clients", default=DEFAULT_CLIENTS, help="comma separated numbers of concurrent uploads")
+    parser.add_argument("--file-size", type=int, default=1024 * 1024)
+    parser.add_argument("--window", type=int, default=64)
+    parser.add_argument("--timeout", type=int, default=300)
+    args = parser.parse_args()
+
+    client_args = ["-m", "-w", str(args.window), "-p", "1400"]
+    with Scratch() as scratch:
+        programs = compile_programs(scratch)
+        make_file(os.path.join(scratch, "bigfile.bin"), args.file_size)
+        print(f"{'clients':>8} {'wall s':>8} {'MB/s':>8} {'slowest ms':>11} {'finished':>9} {'intact':>7}")
+        for clients in [int(c) for c in args.clients.split(",")]:
+            elapsed, results, intact = run_group(programs, scratch, clients, client_args, args.timeout)
+            slowest = max((r["time_ms"] for r in results), default=0)
+            print(f"{clients:>8} {elapsed:>8.2f} {clients * args.file_size / elapsed / 1e6:>8.2f} "
+                  f"{slowest:>11.1f} {len(results):>9} {intact:>7}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""
+Throughput against stream count for udp_client4 -S: the file is split into one range per
+stream, each sent by its own process and socket as a session of its own, and udp_ser4
+writes every range at its offset in one output file. Runs over loopback, where the streams
+share the CPU, and through udp_proxy4 with a long round trip, where a single stream is held
+back by its window. Reports aggregate goodput, the speedup over one stream and how many runs
+arrived intact.
+"""
+
+import argparse
+import os
+
+from benchlib import Scratch, compile_programs, make_file, run_transfer, summarize
+
+LINKS = {
+    "loopback": None,
+    "rtt20": ["-d", "10"],
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--streams", default="1,2,4,8", help="comma separated stream counts")
+    parser.add_argument("--links", default=",".join(LINKS), help="comma separated: " + ", ".join(LINKS))
+    parser.add_argument("--file-size", type=int, default=16 * 1024 * 1024)
+    parser.add_argument("--payload", type=int, default=8192)
+    parser.add_argument("--window", type=int, default=64)
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--timeout", type=int, default=300)
+    args = parser.parse_args()
+
+    common = ["-m", "-w", str(args.window), "-p", str(args.payload)]
+    with Scratch() as scratch:
+        programs = compile_programs(scratch, ("udp_ser4.c", "udp_client4.c", "udp_proxy4.c"))
+        make_file(os.path.join(scratch, "bigfile.bin"), args.file_size)
+        print(f"{'link':>9} {'streams':>8} {'time ms':>9} {'MB/s':>8} {'speedup':>8} {'intact':>7}")
+        for link in args.links.split(","):
+            base = None
+            for n in [int(s) for s in args.streams.split(",")]:
+                runs = []
+                for _ in range(args.iterations):
+                    result = run_transfer(programs, scratch, ["-m"], common + ["-S", str(n)], timeout=args.timeout,
+                                          link=LINKS[link], transfers=n)
+                    if result and result["intact"]:
+                        runs.append(result)
+                if not runs:
+                    print(f"{link:>9} {n:>8}  all runs failed")
+                    continue
+                t = summarize([r["time_ms"] for r in runs])["mean"]
+                rate = args.file_size / t / 1000
+                base = base or rate
+                print(f"{link:>9} {n:>8} {t:>9.2f} {rate:>8.2f} {rate / base:>7.2f}x {len(runs):>4}/{args.iterations}")
+
+
+if __name__ == "__main__":
+    main()
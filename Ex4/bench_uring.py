@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""
+Compare the blocking sockets path of udp_client4/udp_ser4 (one syscall per packet),
+the batched one (-m: sendmmsg/recvmmsg) and the io_uring backend (-u: batched
+sendmsg/recvmsg requests, payloads written to disk asynchronously from registered
+buffers) over several file sizes. Reports transfer time, throughput and the
+syscalls each side made.
+"""
+
+import argparse
+import os
+import re
+
+from benchlib import Scratch, compile_programs, make_file, run_transfer, summarize
+
+MODES = (
+    ("blocking", [], []),
+    ("mmsg", ["-m"], ["-m"]),
+    ("io_uring", ["-u"], ["-u"]),
+)
+
+
+def server_calls(workdir):
+    """Syscalls the server made for the transfer, from its log"""
+    with open(os.path.join(workdir, "server.log")) as f:
+        log = f.read()
+    match = re.search(r"io_uring_enter calls:\s*([0-9]+)", log)
+    if match:
+        return int(match.group(1))
+    match = re.search(r"Receive syscalls:\s*([0-9]+).*ACK syscalls:\s*([0-9]+)", log)
+    return int(match.group(1)) + int(match.group(2)) if match else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--sizes", default="1048576,33554432,268435456", help="comma separated file sizes in bytes")
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--window", type=int, default=256)
+    parser.add_argument("--payload", type=int, default=1400)
+    args = parser.parse_args()
+
+    common = ["-w", str(args.window), "-p", str(args.payload)]
+    with Scratch() as scratch:
+        programs = compile_programs(scratch)
+        print(f"{'size':>10} {'mode':>9} {'time ms':>9} {'MB/s':>8} {'client calls':>13} {'server calls':>13}")
+        for size in [int(s) for s in args.sizes.split(",")]:
+            make_file(os.path.join(scratch, "bigfile.bin"), size)
+            for name, server_flags, client_flags in MODES:
+                runs, calls = [], []
+                for _ in range(args.iterations):
+                    result = run_transfer(programs, scratch, server_flags, common + client_flags)
+                    if result and result["intact"]:
+                        runs.append(result)
+                        calls.append(server_calls(scratch))
+                if not runs:
+                    print(f"{size:>10} {name:>9}  all runs failed")
+                    continue
+                t = summarize([r["time_ms"] for r in runs])["mean"]
+                print(f"{size:>10} {name:>9} {t:>9.1f} {size / t / 1000:>8.2f} "
+                      f"{summarize([r['send_calls'] for r in runs])['mean']:>13.0f} "
+                      f"{summarize(calls)['mean']:>13.0f}")
+
+
+if __name__ == "__main__":
+    main()
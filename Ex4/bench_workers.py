@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+"""
+Scaling of the SO_REUSEPORT receiver (udp_ser4 -w): aggregate throughput of many
+concurrent uploads with 1, 2, 4 and 8 worker processes. Workers beyond the number
+of CPUs can only share cores, so expect the curve to flatten there.
+"""
+
+import argparse
+import os
+
+from bench_sessions import run_group
+from benchlib import Scratch, compile_programs, make_file, summarize
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--workers", default="1,2,4,8", help="comma separated worker counts")
+    parser.add_argument("--clients", type=int, default=64, help="concurrent uploads per run")
+    parser.add_argument("--file-size", type=int, default=1024 * 1024)
+    parser.add_argument("--window", type=int, default=64)
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--timeout", type=int, default=300)
+    args = parser.parse_args()
+
+    client_args = ["-m", "-w", str(args.window), "-p", "1400"]
+    total = args.clients * args.file_size
+    with Scratch() as scratch:
+        programs = compile_programs(scratch)
+        make_file(os.path.join(scratch, "bigfile.bin"), args.file_size)
+        print(f"{os.cpu_count()} CPUs, {args.clients} concurrent uploads of {args.file_size} bytes")
+        print(f"{'workers':>8} {'MB/s':>8} {'stdev':>7} {'intact':>7}")
+        for workers in [int(w) for w in args.workers.split(",")]:
+            rates, intact = [], 0
+            for _ in range(args.iterations):
+                elapsed, _, ok = run_group(programs, scratch, args.clients, client_args, args.timeout,
+                                           ["-m", "-w", str(workers)])
+                rates.append(total / elapsed / 1e6)
+                intact += ok
+            stats = summarize(rates)
+            print(f"{workers:>8} {stats['mean']:>8.2f} {stats['stdev']:>7.2f} "
+                  f"{intact:>4}/{args.clients * args.iterations}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""
+Measure what adaptive compression (udp_client4 -Z) buys: every file kind is sent with
+and without -Z, straight over loopback and through udp_proxy4 as a bandwidth-capped
+WAN. Reports the compression ratio, goodput (file bytes per ms of transfer, the time
+spent compressing included) and the goodput gain of -Z over sending the file as it is.
+"""
+
+import argparse
+import os
+
+from benchlib import Scratch, compile_programs, make_file, run_transfer, summarize
+
+LINKS = {
+    "loopback": None,
+    "wan": ["-d", "10", "-B", "100"],
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--kinds", default="random,text,mixed", help="comma separated file kinds")
+    parser.add_argument("--links", default=",".join(LINKS), help="comma separated: " + ", ".join(LINKS))
+    parser.add_argument("--file-size", type=int, default=8 * 1024 * 1024)
+    parser.add_argument("--payload", type=int, default=8192)
+    parser.add_argument("--window", type=int, default=256)
+    parser.add_argument("--iterations", type=int, default=3)
+    parser.add_argument("--timeout", type=int, default=300)
+    args = parser.parse_args()
+
+    common = ["-m", "-w", str(args.window), "-p", str(args.payload)]
+    with Scratch() as scratch:
+        programs = compile_programs(scratch, ("udp_ser4.c", "udp_client4.c", "udp_proxy4.c"))
+        print(f"{'link':>9} {'kind':>7} {'ratio':>7} {'raw MB/s':>9} {'-Z MB/s':>8} {'gain':>6} {'intact':>7}")
+        for link in args.links.split(","):
+            for kind in args.kinds.split(","):
+                make_file(os.path.join(scratch, "bigfile.bin"), args.file_size, kind)
+                goodput, ratio, intact, total = {}, 1.0, 0, 0
+                for name, flags in (("raw", []), ("zip", ["-Z"])):
+                    runs = []
+                    for _ in range(args.iterations):
+                        result = run_transfer(programs, scratch, ["-m"], common + flags, timeout=args.timeout,
+                                              link=LINKS[link])
+                        total += 1
+                        if result and result["intact"]:
+                            runs.append(result)
+                            intact += 1
+                    if runs:
+                        goodput[name] = args.file_size / summarize([r["time_ms"] for r in runs])["mean"] / 1000
+                        ratio = runs[0].get("zip_ratio", ratio)
+                if len(goodput) < 2:
+                    print(f"{link:>9} {kind:>7}  all runs of a mode failed")
+                    continue
+                print(f"{link:>9} {kind:>7} {ratio:>7.2f} {goodput['raw']:>9.2f} {goodput['zip']:>8.2f} "
+                      f"{goodput['zip'] / goodput['raw']:>5.2f}x {intact:>4}/{total}")
+
+
+if __name__ == "__main__":
+    main()
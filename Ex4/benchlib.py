@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""
+Helpers shared by the Ex4 benchmark scripts: compile the UDP programs, run one
+client/server transfer in a scratch directory and summarise the results
+"""
+
+import glob
+import os
+import re
+import select
+import shutil
+import signal
+import subprocess
+import tempfile
+from statistics import mean, stdev
+
+EX4_DIR = os.path.dirname(os.path.abspath(__file__))
+PROXY_PORT = 5351  # headsock.h: where udp_proxy4 listens
+LIBS = ["-lz", "-lm"]  # zip.h: zlib, and log2 for the entropy estimate
+
+
+def compile_programs(build_dir, sources=("udp_ser4.c", "udp_client4.c"), extra_flags=()):
+    """Compile each source into build_dir and return {program name: path}"""
+    programs = {}
+    for source in sources:
+        name = os.path.splitext(source)[0]
+        path = os.path.join(build_dir, name)
+        result = subprocess.run(
+            ["gcc", "-O2", os.path.join(EX4_DIR, source), "-o", path] + list(extra_flags) + LIBS,
+            capture_output=True,
+            text=True
+        )
+        if result.returncode != 0:
+            raise RuntimeError(f"compiling {source} failed:\n{result.stderr}")
+        programs[name] = path
+    return programs
+
+
+def make_file(path, size, kind="random"):
+    """Write a test file of the given size: random bytes, repetitive text, or alternating
+    megabytes of each ("mixed")"""
+    with open(path, "wb") as f:
+        if kind == "mixed":
+            line = b"the quick brown fox jumps over the lazy dog 0123456789\n"
+            text = (line * ((1 << 20) // len(line) + 1))[:1 << 20]
+            remaining = size
+            while remaining > 0:
+                chunk = min(remaining, 1 << 20)
+                f.write(os.urandom(chunk) if (size - remaining) >> 20 & 1 == 0 else text[:chunk])
+                remaining -= chunk
+        elif kind == "random":
+            remaining = size
+            while remaining > 0:
+                chunk = min(remaining, 1 << 20)
+                f.write(os.urandom(chunk))
+                remaining -= chunk
+        else:
+            line = b"the quick brown fox jumps over the lazy dog 0123456789\n"
+            f.write((line * (size // len(line) + 1))[:size])
+
+
+def parse_client_output(output):
+    """Pull the numbers udp_client4 prints at the end of a run"""
+    patterns = {
+        "time_ms": r"Time\(ms\)\s*:\s*([0-9.]+)",
+        "data_sent_bytes": r"Data sent\(byte\):\s*([0-9]+)",
+        "data_rate_kbps": r"Data rate:\s*([0-9.]+)",
+        "load_ms": r"Load\(ms\)\s*:\s*([0-9.]+)",
+        "peak_rss_kb": r"Peak RSS\(KB\):\s*([0-9]+)",
+        "anon_rss_kb": r"Anonymous RSS\(KB\):\s*([0-9]+)",
+        "send_calls": r"Send syscalls:\s*([0-9]+)",
+        "send_pkts": r"Send syscalls:\s*[0-9]+ for ([0-9]+) packets",
+        "first_byte_ms": r"Phases\(ms.*first byte ([0-9.]+)",
+        "steady_ms": r"Phases\(ms.*steady ([0-9.]+)",
+        "ack_wait_ms": r"Phases\(ms.*ack wait ([0-9.]+)",
+        "teardown_ms": r"Phases\(ms.*teardown ([0-9.]+)",
+        "zip_ratio": r"Compression:.*\(ratio ([0-9.]+)\)",
+    }
+    result = {}
+    for key, pattern in patterns.items():
+        match = re.search(pattern, output)
+        if match:
+            result[key] = float(match.group(1))
+    if "time_ms" not in result or "data_sent_bytes" not in result:
+        return None
+    return result
+
+
+def start_ready(args, ready_flag, **popen_args):
+    """Start a program that takes a readiness descriptor (udp_ser4 -r, udp_proxy4 -R) and
+    return once it says its socket is bound; None if it exited or hung instead"""
+    r, w = os.pipe()
+    try:
+        process = subprocess.Popen(list(args) + [ready_flag, str(w)], pass_fds=(w,), **popen_args)
+    finally:
+        os.close(w)
+    ready = select.select([r], [], [], 10)[0] and os.read(r, 1) == b"R"
+    os.close(r)
+    if not ready:
+        process.kill()
+        process.wait()
+        return None
+    return process
+
+
+def start_proxy(programs, workdir, link):
+    """Start udp_proxy4 with the impairment flags in link; stop it with stop_proxy"""
+    log = open(os.path.join(workdir, "proxy.log"), "w")
+    proxy = start_ready([programs["udp_proxy4"]] + list(link), "-R", cwd=workdir, stdout=log,
+                        stderr=subprocess.STDOUT)
+    if proxy is None:
+        raise RuntimeError("udp_proxy4 did not start, see " + log.name)
+    proxy.log = log
+    return proxy
+
+
+def stop_proxy(proxy):
+    """Stop the proxy and return what it did to each direction, from the lines it prints at exit"""
+    proxy.send_signal(signal.SIGTERM)
+    proxy.wait()
+    proxy.log.close()
+    stats = {}
+    with open(proxy.log.name) as f:
+        for direction, relayed, lost, dropped, duplicated, reordered in re.findall(
+                r"(\S+): (\d+) relayed, (\d+) lost, (\d+) dropped at the bottleneck, (\d+) duplicated, "
+                r"(\d+) reordered", f.read()):
+            stats[direction] = {"relayed": int(relayed), "lost": int(lost), "dropped": int(dropped),
+                                "duplicated": int(duplicated), "reordered": int(reordered)}
+    return stats
+
+
+def run_transfer(programs, workdir, server_args=(), client_args=(), host="localhost", timeout=120, link=None,
+                 transfers=1):
+    """Run one transfer of workdir/bigfile.bin; returns the parsed client numbers or None.
+    With link (udp_proxy4 flags) the transfer goes through the lossy-link proxy, and the
+    result carries the proxy's counters under "link". A file split over several streams
+    (udp_client4 -S) is that many transfers for the server."""
+    # udp_ser4 names each output file after the session that sent it (the streams' group with -S)
+    for old in glob.glob(os.path.join(workdir, "bigfilereceive-*.bin")):
+        os.remove(old)
+
+    # The server's output goes to a file: a pipe nobody reads until the end fills up and
+    # stalls a chatty server mid-transfer
+    server_log = open(os.path.join(workdir, "server.log"), "w")
+    server = start_ready(
+        [programs["udp_ser4"], "-n", str(transfers)] + list(server_args),
+        "-r",
+        cwd=workdir,
+        stdout=server_log,
+        stderr=subprocess.STDOUT,
+        text=True
+    )
+    if server is None:
+        server_log.close()
+        return None
+    proxy = None
+    if link is not None:
+        proxy = start_proxy(programs, workdir, link)
+        client_args = ["-P", str(PROXY_PORT)] + list(client_args)
+    try:
+        client = subprocess.run(
+            [programs["udp_client4"]] + list(client_args) + [host],
+            cwd=workdir,
+            capture_output=True,
+            text=True,
+            timeout=timeout
+        )
+        server.communicate(timeout=timeout)
+    except subprocess.TimeoutExpired:
+        server.kill()
+        server.communicate()
+        return None
+    finally:
+        if server.poll() is None:
+            server.kill()
+            server.communicate()
+        server_log.close()
+        if proxy is not None:
+            link_stats = stop_proxy(proxy)
+
+    result = parse_client_output(client.stdout)
+    if result is None:
+        return None
+    if proxy is not None:
+        result["link"] = link_stats
+    received = glob.glob(os.path.join(workdir, "bigfilereceive-*.bin"))
+    if len(received) != 1:
+        return None
+    with open(os.path.join(workdir, "bigfile.bin"), "rb") as a, open(received[0], "rb") as b:
+        result["intact"] = a.read() == b.read()
+    return result
+
+
+def summarize(values):
+    """Mean, min, max and standard deviation of a list of numbers"""
+    return {
+        "mean": mean(values),
+        "min": min(values),
+        "max": max(values),
+        "stdev": stdev(values) if len(values) > 1 else 0.0,
+    }
+
+
+class Scratch:
+    """Temporary directory holding compiled programs and test files"""
+
+    def __enter__(self):
+        self.path = tempfile.mkdtemp(prefix="ex4bench")
+        return self.path
+
+    def __exit__(self, *exc):
+        shutil.rmtree(self.path, ignore_errors=True)
@@ -0,0 +1,206 @@
+// congestion control for the UDP client: how many packets may be in flight
+#ifndef CC_H
+#define CC_H
+
+#include <stdio.h>
+#include <string.h>
+#include "rto.h"
+
+#define CC_INIT_WINDOW 2  // packets in flight before any feedback
+#define CC_INIT_SSTHRESH 1024  // slow start ends here unless a loss comes first
+#define VEGAS_ALPHA 2  // fewer packets than this queued in the network: grow
+#define VEGAS_BETA 4  // more than this queued: shrink
+
+struct cc_so;
+
+// One controller. init is the first window; on_ack gets the number of packets an ACK
+// newly covered and an RTT sample in microseconds (0 when the ACK carries no usable
+// sample, Karn's rule); on_loss is a packet found missing by the acks after it;
+// on_timeout is a timer expiry.
+struct cc_ops
+{
+const char *name;
+int init;
+void (*on_ack)(struct cc_so *c, int acked, long rtt);
+void (*on_loss)(struct cc_so *c);
+void (*on_timeout)(struct cc_so *c);
+};
+
+struct cc_so			//congestion controller state, windows in packets
+{
+const struct cc_ops *ops;
+double cwnd;				// packets allowed in flight
+double ssthresh;			// slow start below this, congestion avoidance above
+int max;					// never more than this (the receiver's window)
+long base_rtt;				// smallest RTT seen (delay-based controllers), 0 = none yet
+long epoch_rtt;				// smallest RTT seen in the current round trip
+long epoch_end;				// when the current round trip ends (us)
+long recover;				// losses of packets sent before this one were already answered
+FILE *log;					// -l: one "time_us cwnd ssthresh" line per change
+long start;					// time the log is relative to
+};
+
+static void cc_log(struct cc_so *c)
+{
+    if (c->log != NULL)
+        fprintf(c->log, "%ld %.2f %.2f\n", now_us() - c->start, c->cwnd, c->ssthresh);
+}
+
+static void cc_clamp(struct cc_so *c)
+{
+    if (c->cwnd < 1)
+        c->cwnd = 1;
+    if (c->cwnd > c->max)
+        c->cwnd = c->max;
+}
+
+// Slow start doubles the window every round trip (+1 per acked packet); congestion
+// avoidance adds one packet per round trip (+1/cwnd per acked packet)
+static void reno_on_ack(struct cc_so *c, int acked, long rtt)
+{
+    (void)rtt;
+    while (acked-- > 0)
+    {
+        if (c->cwnd < c->ssthresh)
+            c->cwnd += 1;
+        else
+            c->cwnd += 1 / c->cwnd;
+    }
+}
+
+// Multiplicative decrease: halve, and carry on from there without slow start
+static void reno_on_loss(struct cc_so *c)
+{
+    c->ssthresh = c->cwnd / 2 < 2 ? 2 : c->cwnd / 2;
+    c->cwnd = c->ssthresh;
+}
+
+// Nothing got through for a whole timeout: start again from one packet
+static void reno_on_timeout(struct cc_so *c)
+{
+    c->ssthresh = c->cwnd / 2 < 2 ? 2 : c->cwnd / 2;
+    c->cwnd = 1;
+}
+
+// Delay-based (TCP Vegas): once per round trip compare the expected rate cwnd / base_rtt
+// with the actual rate cwnd / rtt. Their difference times base_rtt is the number of packets
+// sitting in queues; keep it between VEGAS_ALPHA and VEGAS_BETA. Losses still halve.
+static void vegas_on_ack(struct cc_so *c, int acked, long rtt)
+{
+    double queued;
+    long now;
+
+    if (rtt > 0)
+    {
+        if (c->base_rtt == 0 || rtt < c->base_rtt)
+            c->base_rtt = rtt;
+        if (c->epoch_rtt == 0 || rtt < c->epoch_rtt)
+            c->epoch_rtt = rtt;
+    }
+    now = now_us();
+    if (c->epoch_rtt == 0 || now < c->epoch_end)
+    {
+        if (c->cwnd < c->ssthresh)
+            c->cwnd += acked;   // slow start until the first verdict
+        return;
+    }
+
+    queued = c->cwnd * (c->epoch_rtt - c->base_rtt) / c->epoch_rtt;
+    if (c->cwnd >= c->ssthresh || queued >= 1)
+    {
+        if (c->cwnd < c->ssthresh)
+            c->ssthresh = c->cwnd;  // queues are building: leave slow start
+        if (queued < VEGAS_ALPHA)
+            c->cwnd += 1;
+        else if (queued > VEGAS_BETA)
+            c->cwnd -= 1;
+    }
+    c->epoch_end = now + c->epoch_rtt;
+    c->epoch_rtt = 0;
+}
+
+// The assignment's schedule, batches of 1, 2 and 3 whatever happens, for comparison
+static void fixed_on_ack(struct cc_so *c, int acked, long rtt)
+{
+    (void)acked;
+    (void)rtt;
+    c->cwnd = (int)c->cwnd % 3 + 1;
+}
+
+static void fixed_hold(struct cc_so *c)
+{
+    (void)c;
+}
+
+static const struct cc_ops cc_algos[] =
+{
+    {"reno", CC_INIT_WINDOW, reno_on_ack, reno_on_loss, reno_on_timeout},
+    {"vegas", CC_INIT_WINDOW, vegas_on_ack, reno_on_loss, reno_on_timeout},
+    {"fixed", 1, fixed_on_ack, fixed_hold, fixed_hold},
+};
+
+static const struct cc_ops *cc_find(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(cc_algos) / sizeof(cc_algos[0]); i++)
+        if (strcmp(cc_algos[i].name, name) == 0)
+            return &cc_algos[i];
+    return NULL;
+}
+
+// Select a controller by name; returns -1 if there is none by that name
+static int cc_init(struct cc_so *c, const char *name, int max, FILE *log)
+{
+    memset(c, 0, sizeof(*c));
+    c->ops = cc_find(name);
+    if (c->ops == NULL)
+        return -1;
+    c->cwnd = c->ops->init;
+    c->ssthresh = CC_INIT_SSTHRESH;
+    c->max = max;
+    c->log = log;
+    c->start = now_us();
+    cc_clamp(c);
+    cc_log(c);
+    return 0;
+}
+
+static void cc_ack(struct cc_so *c, int acked, long rtt)
+{
+    int before = (int)c->cwnd;
+
+    c->ops->on_ack(c, acked, rtt);
+    cc_clamp(c);
+    if ((int)c->cwnd != before)
+        cc_log(c);
+}
+
+// Packet seq was lost while next was the first packet never sent. Only the first loss
+// of a window counts: the others were sent at the old rate before the sender could know.
+static void cc_loss(struct cc_so *c, long seq, long next)
+{
+    if (seq < c->recover)
+        return;
+    c->recover = next;
+    c->ops->on_loss(c);
+    cc_clamp(c);
+    cc_log(c);
+}
+
+// A timer expired while next was the first packet never sent
+static void cc_timeout(struct cc_so *c, long next)
+{
+    c->recover = next;
+    c->ops->on_timeout(c);
+    cc_clamp(c);
+    cc_log(c);
+}
+
+// Whole packets the sender may have in flight now
+static int cc_window(struct cc_so *c)
+{
+    return (int)c->cwnd;
+}
+
+#endif
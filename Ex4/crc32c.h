@@ -0,0 +1,161 @@
+// CRC32C (Castagnoli): the optional per-packet checksum of the v2 wire format and the
+// whole-file hash of udp_client4 -H. On x86 CPUs with SSE4.2 it is computed by the crc32
+// instruction, eight bytes at a time on three independent streams; elsewhere by slicing-by-8,
+// eight table lookups per eight bytes. Both give the same result as the one-byte-at-a-time table.
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82f63b78  // reflected Castagnoli polynomial
+#define CRC32C_LANE 256  // bytes per stream of the SSE4.2 kernel's three-way interleave
+
+enum {CRC32C_BYTE, CRC32C_SLICE8, CRC32C_SSE42};  // kernels, fastest available is the default
+
+static uint32_t crc32c_table[8][256];  // [0] is the byte table, [k] advances [0] by k more zero bytes
+static uint32_t crc32c_shift[4][256];  // byte k of a crc, advanced over CRC32C_LANE zero bytes
+static int crc32c_kernel = -1;  // -1 until crc32c_init()
+
+static inline void crc32c_init(void)
+{
+    uint32_t c;
+    int i, k, n;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+        for (k = 1; k < 8; k++)
+            crc32c_table[k][i] = crc32c_table[0][crc32c_table[k - 1][i] & 0xff] ^ (crc32c_table[k - 1][i] >> 8);
+    // Running a crc over zero bytes is linear in the crc, so four tables of 256 do it for any value
+    for (i = 0; i < 256; i++)
+        for (k = 0; k < 4; k++)
+        {
+            c = (uint32_t)i << (8 * k);
+            for (n = 0; n < CRC32C_LANE; n++)
+                c = crc32c_table[0][c & 0xff] ^ (c >> 8);
+            crc32c_shift[k][i] = c;
+        }
+    crc32c_kernel = CRC32C_SLICE8;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_kernel = CRC32C_SSE42;
+#endif
+}
+
+// The kernels work on the inverted crc and do no initialisation; use crc32c()
+static inline uint32_t crc32c_byte(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n-- > 0)
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static inline uint32_t crc32c_slice8(uint32_t crc, const unsigned char *p, size_t n)
+{
+    uint32_t lo, hi;
+
+    for (; n > 0 && ((uintptr_t)p & 7) != 0; n--)
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        memcpy(&lo, p, 4);  // little-endian hosts only, as is the rest of the wire format
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+              crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+              crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+    }
+    return crc32c_byte(crc, p, n);
+}
+
+// crc advanced over CRC32C_LANE zero bytes
+static inline uint32_t crc32c_lane(uint32_t crc)
+{
+    return crc32c_shift[0][crc & 0xff] ^ crc32c_shift[1][(crc >> 8) & 0xff] ^
+           crc32c_shift[2][(crc >> 16) & 0xff] ^ crc32c_shift[3][crc >> 24];
+}
+
+#if defined(__x86_64__)
+// One crc32 instruction has a latency of three cycles but a new one can start every cycle, so
+// three lanes are hashed side by side and joined: the crc of A then B is A's crc run over as
+// many zero bytes as B has, xor B's crc started from zero.
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t n)
+{
+    uint64_t c = crc, c1, c2, w, w1, w2;
+    int i;
+
+    for (; n > 0 && ((uintptr_t)p & 7) != 0; n--)
+        c = _mm_crc32_u8(c, *p++);
+    for (; n >= 3 * CRC32C_LANE; n -= 3 * CRC32C_LANE, p += 3 * CRC32C_LANE)
+    {
+        c1 = c2 = 0;
+        for (i = 0; i < CRC32C_LANE; i += 8)
+        {
+            memcpy(&w, p + i, 8);
+            memcpy(&w1, p + CRC32C_LANE + i, 8);
+            memcpy(&w2, p + 2 * CRC32C_LANE + i, 8);
+            c = _mm_crc32_u64(c, w);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+        }
+        c = crc32c_lane(crc32c_lane(c) ^ c1) ^ c2;
+    }
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+    }
+    while (n-- > 0)
+        c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+#endif
+
+// Continue crc over n more bytes with a given kernel; start with crc32c_with(k, 0, ...)
+static inline uint32_t crc32c_with(int kernel, uint32_t crc, const void *buf, size_t n)
+{
+    if (crc32c_kernel < 0)
+        crc32c_init();
+    crc = ~crc;
+    switch (kernel)
+    {
+#if defined(__x86_64__)
+        case CRC32C_SSE42:
+            crc = crc32c_sse42(crc, buf, n);
+            break;
+#endif
+        case CRC32C_SLICE8:
+            crc = crc32c_slice8(crc, buf, n);
+            break;
+        default:
+            crc = crc32c_byte(crc, buf, n);
+    }
+    return ~crc;
+}
+
+// Continue crc over n more bytes; start with crc32c(0, ...)
+static inline uint32_t crc32c(uint32_t crc, const void *buf, size_t n)
+{
+    if (crc32c_kernel < 0)
+        crc32c_init();  // crc32c_kernel is read before crc32c_with() would set it
+    return crc32c_with(crc32c_kernel, crc, buf, n);
+}
+
+static inline const char *crc32c_name(int kernel)
+{
+    return kernel == CRC32C_SSE42 ? "sse4.2" : kernel == CRC32C_SLICE8 ? "slicing-by-8" : "byte table";
+}
+
+#endif
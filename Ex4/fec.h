@@ -0,0 +1,213 @@
+// Reed-Solomon erasure code over GF(2^8) for batch-mode forward error correction
+#ifndef FEC_H
+#define FEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define GF_POLY 0x11d  // x^8 + x^4 + x^3 + x^2 + 1
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_lo[256][16], gf_hi[256][16];  // c * x for the low and the high nibble x, per c
+static int fec_simd;  // 2 = AVX2, 1 = SSSE3, 0 = one table lookup per byte
+
+static inline void fec_init(void)
+{
+    int i, x = 1, c;
+
+    for (i = 0; i < 255; i++)
+    {
+        gf_exp[i] = gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLY;
+    }
+    for (c = 0; c < 256; c++)
+        for (i = 0; i < 16; i++)
+        {
+            gf_lo[c][i] = (c && i) ? gf_exp[gf_log[c] + gf_log[i]] : 0;
+            gf_hi[c][i] = (c && i) ? gf_exp[gf_log[c] + gf_log[i << 4]] : 0;
+        }
+    fec_simd = 0;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    fec_simd = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("ssse3") ? 1 : 0;
+#endif
+}
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    return (a && b) ? gf_exp[gf_log[a] + gf_log[b]] : 0;
+}
+
+static inline uint8_t gf_inv(uint8_t a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+// dst ^= c * src over n bytes. The product of a byte is the XOR of the products of its two
+// nibbles, and a 16-entry table per nibble fits one register: pshufb looks up 16 (32 with
+// AVX2) bytes at once.
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static inline size_t gf_muladd_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)gf_lo[c]));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)gf_hi[c]));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i s, p;
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+        s = _mm256_loadu_si256((const __m256i *)(src + i));
+        p = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+                             _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((__m256i *)(dst + i)), p));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static inline size_t gf_muladd_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    __m128i lo = _mm_loadu_si128((const __m128i *)gf_lo[c]);
+    __m128i hi = _mm_loadu_si128((const __m128i *)gf_hi[c]);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i s, p;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+        s = _mm_loadu_si128((const __m128i *)(src + i));
+        p = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+                          _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((__m128i *)(dst + i)), p));
+    }
+    return i;
+}
+#endif
+
+static inline void gf_muladd(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    size_t i = 0;
+
+    if (c == 0)
+        return;
+    if (c == 1)
+    {
+        // Plain XOR: the whole of single-parity coding, and left to the compiler to vectorise
+        for (; i < n; i++)
+            dst[i] ^= src[i];
+        return;
+    }
+#if defined(__x86_64__)
+    if (fec_simd == 2)
+        i = gf_muladd_avx2(dst, src, c, n);
+    else if (fec_simd == 1)
+        i = gf_muladd_ssse3(dst, src, c, n);
+#endif
+    for (; i < n; i++)
+        dst[i] ^= gf_lo[c][src[i] & 15] ^ gf_hi[c][src[i] >> 4];
+}
+
+// Coefficient of data packet i in parity packet j: a Cauchy matrix 1 / (x_j + y_i) with
+// distinct x_j = j and y_i = FEC_MAXM + i, its columns scaled so that row 0 is all ones.
+// Every square submatrix stays invertible, so any count of the count + m packets of a block
+// rebuild it, and with one parity packet the code is plain XOR parity.
+static inline uint8_t fec_coef(int j, int i)
+{
+    uint8_t y = FEC_MAXM + i;
+
+    return gf_mul(gf_inv(j ^ y), y);
+}
+
+// Parity packet j of a block: the sum of coef(j, i) * data[i] over its count packets, each
+// lens[i] bytes and taken as zero-padded to len
+static inline void fec_encode(uint8_t *parity, uint8_t **data, const int *lens, int count, int j, int len)
+{
+    int i;
+
+    memset(parity, 0, len);
+    for (i = 0; i < count; i++)
+        gf_muladd(parity, data[i], fec_coef(j, i), lens[i]);
+}
+
+// Rebuild the data packets of a block whose bit is clear in have, from the data packets that
+// are there and the parity packets whose bit is set in have_parity; every buffer holds len
+// bytes. The parity buffers used are overwritten. Returns how many packets were rebuilt, or
+// -1 when fewer parity packets arrived than data packets are missing.
+static inline int fec_recover(uint8_t **data, uint64_t have, uint8_t **parity, unsigned have_parity, int count, int len)
+{
+    int miss[FEC_MAXM], rows[FEC_MAXM];
+    uint8_t a[FEC_MAXM][FEC_MAXM], inv[FEC_MAXM][FEC_MAXM], f;
+    int e = 0, r = 0, i, j, c, p;
+
+    for (i = 0; i < count; i++)
+        if (!(have >> i & 1))
+        {
+            if (e == FEC_MAXM)
+                return -1;
+            miss[e++] = i;
+        }
+    for (j = 0; j < FEC_MAXM && r < e; j++)
+        if (have_parity >> j & 1)
+            rows[r++] = j;
+    if (r < e)
+        return -1;
+
+    // parity[j] minus what the packets we have put in leaves the missing ones' share
+    for (r = 0; r < e; r++)
+        for (i = 0; i < count; i++)
+            if (have >> i & 1)
+                gf_muladd(parity[rows[r]], data[i], fec_coef(rows[r], i), len);
+
+    // Invert the e x e system by Gauss-Jordan elimination
+    for (r = 0; r < e; r++)
+        for (c = 0; c < e; c++)
+        {
+            a[r][c] = fec_coef(rows[r], miss[c]);
+            inv[r][c] = r == c;
+        }
+    for (c = 0; c < e; c++)
+    {
+        for (p = c; a[p][c] == 0; p++)
+            ;
+        for (j = 0; j < e; j++)
+        {
+            f = a[c][j], a[c][j] = a[p][j], a[p][j] = f;
+            f = inv[c][j], inv[c][j] = inv[p][j], inv[p][j] = f;
+        }
+        f = gf_inv(a[c][c]);
+        for (j = 0; j < e; j++)
+        {
+            a[c][j] = gf_mul(a[c][j], f);
+            inv[c][j] = gf_mul(inv[c][j], f);
+        }
+        for (r = 0; r < e; r++)
+            if (r != c && a[r][c] != 0)
+            {
+                f = a[r][c];
+                for (j = 0; j < e; j++)
+                {
+                    a[r][j] ^= gf_mul(f, a[c][j]);
+                    inv[r][j] ^= gf_mul(f, inv[c][j]);
+                }
+            }
+    }
+    for (c = 0; c < e; c++)
+    {
+        memset(data[miss[c]], 0, len);
+        for (r = 0; r < e; r++)
+            gf_muladd(data[miss[c]], parity[rows[r]], inv[c][r], len);
+    }
+    return e;
+}
+
+#endif
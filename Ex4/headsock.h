@@ -1,4 +1,5 @@
 // headfile for TCP program
+#define _GNU_SOURCE  // sendmmsg/recvmmsg
 #include <stdbool.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -13,24 +14,149 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <sched.h>
+#include <sys/wait.h>
 
 #define NEWFILE (O_WRONLY|O_CREAT|O_TRUNC)
 #define MYTCP_PORT 4950
 #define MYUDP_PORT 5350
-#define DATALEN 100
+#define PROXY_PORT 5351  // udp_proxy4 listens here and relays to MYUDP_PORT
+#define DATALEN 100  // default payload size; udp_client4 -p negotiates another one per transfer
+#define MINDATALEN 16  // smallest payload a transfer may negotiate
+#define MAXDATALEN (65507 - WIREHEADLEN - CSUMLEN)  // largest payload one UDP/IPv4 datagram can carry
 #define BUFSIZE 1024000  // 1MB buffer - can handle files up to 1MB
 #define PACKLEN 108
-#define HEADLEN 8
+#define HEADLEN 8  // v1 pack_so header, still spoken by the single variants
+#define WIRE_VERSION 2  // data_so and hello_so layout spoken by udp_client4 and udp_ser4
+#define WIREHEADLEN 16  // bytes of data_so before the optional checksum
+#define CSUMLEN 4  // CRC32C after the header when PKT_CSUM is set
+#define MAXWINDOW 4096  // largest selective-repeat window (packets in flight)
+#define MMSG_MAX 1024  // most datagrams moved by one sendmmsg/recvmmsg call
+#define MMSG_POOL (4 * 1024 * 1024)  // bytes of packet buffers behind one sendmmsg/recvmmsg call
+#define SOCKBUF (4 * 1024 * 1024)  // socket buffer size both sides ask for
+#define WRITEBACK_BYTES (8 * 1024 * 1024)  // receiver starts disk writeback every this many bytes
+#define LINGER_MS 200  // how long the receiver keeps re-acking after the last byte
+#define IDLE_MS 10000  // udp_ser4 drops a session that has been silent this long
+#define SESSION_BUCKETS 1024  // hash buckets of udp_ser4's session table
+#define MAXWORKERS 64  // most SO_REUSEPORT workers udp_ser4 -w starts
+#define MAXSTREAMS 64  // most parallel streams udp_client4 -S splits a file over
+#define URING_DEPTH 1024  // submission queue entries of the -u io_uring backends
+#define URING_RECVS 256  // receives udp_ser4 -u keeps posted, each with its own buffer slot
+#define URING_ACKS 512  // ACK sends udp_ser4 -u may have in flight
+#define URING_FILES 1024  // fixed-file table of udp_ser4 -u: the socket, then output files
 
-struct pack_so			//data packet structure
+struct pack_so			//v1 data packet structure, used by the single variants
 {
 uint32_t num;				// the sequence number
-uint32_t len;					// the packet length
+uint32_t len;					// the file length
 char data[DATALEN];	//the packet data
 };
 
-struct ack_so
+#define PKT_FIRST 0x01  // the packet at offset 0
+#define PKT_LAST 0x02  // the packet that ends the file
+#define PKT_RETX 0x04  // sent before: a retransmission
+#define PKT_CSUM 0x08  // a CRC32C of header and payload follows the header
+#define PKT_EOB 0x10  // batch mode: last DU of its batch, the server acks once it has them all
+#define PKT_FEC 0x20  // a parity packet: fec_so, then parity over a block of the batch's DUs
+#define FECHEADLEN 4  // bytes of fec_so before the parity
+#define FEC_MAXK 64  // most DUs one block of parity protects
+#define FEC_MAXM 16  // most parity packets per block
+#define FEC_PENDING 4  // blocks of a batch udp_ser4 collects at the same time
+
+struct data_so			//v2 data packet header: WIREHEADLEN bytes, the checksum if PKT_CSUM, then len payload bytes
+{
+uint8_t version;			// WIRE_VERSION
+uint8_t flags;				// PKT_* bits
+uint16_t len;				// payload bytes
+uint32_t session;			// session id from the hello, udp_ser4 demultiplexes on it
+uint64_t offset;			// where the payload goes in the file; a multiple of the negotiated payload size
+};
+
+#define HELLO_MAGIC 0x48344545  // "EE4H": marks a transfer-setup datagram
+#define MODE_BATCH 0  // 1-2-3 batches, one ack_so per batch
+#define MODE_SR 1  // selective repeat, cumulative + selective acks
+#define MODE_QUERY 2  // -r: no transfer, a question: which blocks of the file are stored already
+
+struct hello_so			//first datagram of a transfer, echoed back with the accepted payload size
+{
+uint32_t magic;				// HELLO_MAGIC
+uint32_t version;			// WIRE_VERSION; the server answers with its own, and only serves its own
+uint32_t mode;				// MODE_BATCH or MODE_SR, or MODE_QUERY (-r)
+uint32_t datalen;			// payload bytes per packet
+uint32_t session;			// chosen by the client, names the transfer together with its address
+uint8_t fec_k;				// batch mode: parity is sent for every fec_k DUs of a batch (0 = no FEC)
+uint8_t fec_m;				// parity packets per block; the server answers 0, 0 if it will not decode
+uint8_t hash;				// 1 = file_crc is the CRC32C of the whole file, for the server to check at the end
+uint8_t zip;				// 1 = the packets carry the file's zblock_so image, size bytes of it
+uint64_t size;				// file size in bytes; with zip, size of the image
+uint32_t file_crc;			// -H: CRC32C of the file bytes this session carries (its range with -S, -r), before -Z; 0 = no check
+uint32_t resume;			// -r: 1 = checkpoint the blocks stored, so a transfer cut off can be resumed
+uint64_t raw_size;			// file size in bytes
+uint64_t base;				// where in the output file byte 0 of the file goes; -S and -r send ranges.
+							// MODE_QUERY: the byte whose block the answer starts at
+uint64_t total;				// size of the whole output file (raw_size unless -S or -r)
+uint32_t group;				// -S, -r: the same on every range of one file, names the output file
+uint16_t stream;			// -S: which range this session carries, from 0
+uint16_t streams;			// -S: ranges the file is split into, 1 = all of it in this session
+};
+
+#define RESUME_MAGIC 0x52344545  // "EE4R": the answer to a MODE_QUERY hello
+#define RESUME_BLOCK (1024 * 1024)  // file bytes per block of the receiver's checkpoint map
+#define RESUME_MAPBYTES 1024  // bitmap bytes in one answer: 8192 blocks, 8GB of file
+#define RESUMEHEADLEN 24  // bytes of resume_so before the bitmap
+#define CHECKPOINT_BYTES (4 * 1024 * 1024)  // -r: the receiver makes what it stored durable this often
+
+// A MODE_QUERY hello names the file by group and total and asks about the blocks from the one
+// holding byte base on
+struct resume_so		//answer to a MODE_QUERY hello: RESUMEHEADLEN bytes, then (count + 7) / 8 bytes of map
+{
+uint32_t magic;				// RESUME_MAGIC
+uint32_t session;			// the query's
+uint32_t block;				// RESUME_BLOCK
+uint32_t blocks;			// blocks in the file, the last may be shorter
+uint32_t first;				// the block bit 0 of map[0] stands for
+uint32_t count;				// blocks this answer covers
+uint8_t map[RESUME_MAPBYTES];	// bit i set = block first + i is stored on disk for good
+};
+
+#define ZBLOCK (64 * 1024)  // file bytes per compression block (the last may be shorter)
+#define ZHEADLEN 8  // bytes of zblock_so before the block's data
+#define ZIP_RAW 0
+#define ZIP_DEFLATE 1
+
+struct zblock_so		//one block of a compressed transfer: the header, then len bytes of data
+{
+uint32_t len;				// bytes of data that follow
+uint8_t method;				// ZIP_RAW: the block's bytes as they are; ZIP_DEFLATE: a zlib stream of them
+uint8_t pad[3];
+};
+
+// A parity packet's data_so names its block: offset is the block's first DU and len is
+// FECHEADLEN plus the negotiated payload size. Shorter DUs count as zero-padded.
+struct fec_so
+{
+uint8_t index;				// which of the block's fec_m parity packets this is
+uint8_t count;				// DUs in the block: fec_k, or fewer where the batch ends
+uint16_t pad;
+};
+
+#define SACK_WORDS 8  // 64-bit words of selective-ack bitmap: 512 packets past the cumulative point
+#define ACKHEADLEN 8  // bytes of ack_so before the bitmap
+#define ACK_EVERY 16  // the receiver acks at least this often, and whenever its queue runs dry
+#define DUPTHRESH 3  // a hole with this many later packets acknowledged is a loss
+
+struct ack_so			//acknowledgment, ACKHEADLEN + 8 * len bytes on the wire
 {
-uint8_t num;
-uint8_t len;
+uint8_t num;				// 1 = acknowledgment
+uint8_t len;				// 64-bit words of sack[] that follow
+uint8_t tag;				// batch mode: low byte of the last sequence number of the batch
+uint8_t pad;
+uint32_t cum;				// cumulative ack: every packet below cum has arrived
+uint64_t sack[SACK_WORDS];	// bit i set = packet cum + 1 + i has arrived as well
 };
@@ -0,0 +1,79 @@
+// retransmission timeout estimator for the UDP client (RFC 6298 style)
+#ifndef RTO_H
+#define RTO_H
+
+#include <time.h>
+
+#define RTO_INIT_US 100000  // timeout before the first RTT sample
+#define RTO_MIN_US 2000  // floor, so scheduling noise on loopback is not taken for loss
+#define RTO_MAX_US 2000000  // ceiling for exponential backoff
+#define RTO_MAX_RETRIES 12  // consecutive timeouts before the peer is declared dead
+
+struct rto_so			//RTT estimator state, all times in microseconds
+{
+long srtt;					// smoothed round trip time, 0 until the first sample
+long rttvar;				// smoothed mean deviation of the round trip time
+long rto;					// current timeout including backoff
+int retries;				// consecutive timeouts without a fresh sample
+};
+
+static long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void rto_init(struct rto_so *r)
+{
+    r->srtt = 0;
+    r->rttvar = 0;
+    r->rto = RTO_INIT_US;
+    r->retries = 0;
+}
+
+static void rto_clamp(struct rto_so *r)
+{
+    if (r->rto < RTO_MIN_US)
+        r->rto = RTO_MIN_US;
+    if (r->rto > RTO_MAX_US)
+        r->rto = RTO_MAX_US;
+}
+
+// Feed one RTT measurement. Callers must skip packets that were retransmitted
+// (Karn's rule): their ACK cannot be matched to a particular transmission.
+static void rto_sample(struct rto_so *r, long rtt)
+{
+    long err;
+
+    if (rtt < 1)
+        rtt = 1;
+    if (r->srtt == 0)
+    {
+        r->srtt = rtt;
+        r->rttvar = rtt / 2;
+    }
+    else
+    {
+        err = rtt - r->srtt;
+        if (err < 0)
+            err = -err;
+        r->rttvar += (err - r->rttvar) / 4;     // rttvar = 3/4 rttvar + 1/4 |srtt - rtt|
+        r->srtt += (rtt - r->srtt) / 8;         // srtt = 7/8 srtt + 1/8 rtt
+    }
+    r->rto = r->srtt + 4 * r->rttvar;
+    r->retries = 0;
+    rto_clamp(r);
+}
+
+// A timer expired: double the timeout. Returns -1 once the peer looks dead.
+static int rto_backoff(struct rto_so *r)
+{
+    r->rto *= 2;
+    rto_clamp(r);
+    if (++r->retries > RTO_MAX_RETRIES)
+        return -1;
+    return 0;
+}
+
+#endif
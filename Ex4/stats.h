@@ -0,0 +1,133 @@
+// Hot-path statistics for udp_client4 and udp_ser4: plain counters, a histogram of ACK round
+// trip times and an optional binary trace of packet events, dumped when the program exits
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RTT_BUCKETS 24  // bucket b counts round trips of 2^b to 2^(b+1) - 1 us; the last one, anything longer
+#define TRACE_LEN 65536  // trace events kept; once full the oldest are overwritten
+#define TRACE_MAGIC 0x34435254  // "TRC4", first word of a trace dump
+
+enum {TR_SEND, TR_RETX, TR_RECV, TR_ACK_SENT, TR_ACK_RECV, TR_TIMEOUT, TR_DROP, TR_REBUILT};
+
+struct stats_so			//counters, one increment each on the hot path
+{
+long packets;				// data packets sent (client) or received (server), parity and resends included
+long bytes;					// their payload bytes
+long retransmits;			// of those, resends (client) or packets flagged PKT_RETX (server)
+long send_calls, send_pkts;	// send syscalls made and datagrams they carried
+long recv_calls, recv_pkts;	// receive syscalls made and datagrams they returned
+long misfits;				// server: packets dropped for an offset or length outside the file
+long beyond_window;			// server: packets dropped for lying a whole window past the cumulative point
+long rtt_samples;			// ACK round trips measured (Karn's rule: none from resent packets)
+long rtt_sum, rtt_min, rtt_max;
+long rtt_hist[RTT_BUCKETS];
+};
+
+struct trace_so			//one trace event, written to the dump exactly as it is in memory
+{
+uint64_t t_ns;				// CLOCK_MONOTONIC
+uint32_t session;
+uint16_t event;				// TR_*
+uint16_t len;				// payload bytes, or ACK bytes
+int64_t seq;				// packet number, or the ACK's cumulative point
+};
+
+static struct stats_so stats;
+static struct trace_so *trace_ring = NULL;  // NULL = tracing off
+static unsigned long trace_count = 0;  // events recorded, the ring holds the last TRACE_LEN
+static const char *trace_path;
+
+static inline void stats_rtt(long us)
+{
+    int b = us > 0 ? 63 - __builtin_clzl(us) : 0;
+
+    if (b >= RTT_BUCKETS)
+        b = RTT_BUCKETS - 1;
+    stats.rtt_hist[b]++;
+    if (stats.rtt_samples == 0 || us < stats.rtt_min)
+        stats.rtt_min = us;
+    if (us > stats.rtt_max)
+        stats.rtt_max = us;
+    stats.rtt_samples++;
+    stats.rtt_sum += us;
+}
+
+static inline void trace(int event, uint32_t session, int64_t seq, int len)
+{
+    struct trace_so *t;
+    struct timespec ts;
+
+    if (trace_ring == NULL)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t = &trace_ring[trace_count++ % TRACE_LEN];
+    t->t_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    t->session = session;
+    t->event = event;
+    t->len = len;
+    t->seq = seq;
+}
+
+// Dump format: TRACE_MAGIC, sizeof(struct trace_so) and the number of events as three
+// uint32_t, then the events oldest first. trace4.py prints it.
+static inline void trace_dump(void)
+{
+    uint32_t head[3];
+    unsigned long first, n, i;
+    FILE *f;
+
+    if (trace_ring == NULL || (f = fopen(trace_path, "wb")) == NULL)
+        return;
+    n = trace_count < TRACE_LEN ? trace_count : TRACE_LEN;
+    first = trace_count - n;
+    head[0] = TRACE_MAGIC;
+    head[1] = sizeof(struct trace_so);
+    head[2] = n;
+    fwrite(head, sizeof(head), 1, f);
+    for (i = first; i < trace_count; i++)
+        fwrite(&trace_ring[i % TRACE_LEN], sizeof(struct trace_so), 1, f);
+    fclose(f);
+}
+
+// Start recording events; the ring goes to path when the program exits
+static inline int trace_open(const char *path)
+{
+    trace_ring = malloc(TRACE_LEN * sizeof(struct trace_so));
+    if (trace_ring == NULL)
+        return -1;
+    trace_path = path;
+    atexit(trace_dump);
+    return 0;
+}
+
+static inline void stats_print(FILE *out)
+{
+    int b, first, last;
+
+    fprintf(out, "Stats: %ld data packets, %ld payload bytes, %ld retransmitted\n",
+            stats.packets, stats.bytes, stats.retransmits);
+    fprintf(out, "Stats: %ld send syscalls for %ld datagrams, %ld receive syscalls for %ld datagrams\n",
+            stats.send_calls, stats.send_pkts, stats.recv_calls, stats.recv_pkts);
+    if (stats.rtt_samples == 0)
+        return;
+    fprintf(out, "ACK RTT(us): %ld samples, min %ld, mean %ld, max %ld\n", stats.rtt_samples, stats.rtt_min,
+            stats.rtt_sum / stats.rtt_samples, stats.rtt_max);
+    for (first = 0; stats.rtt_hist[first] == 0; first++)
+        ;
+    for (last = RTT_BUCKETS - 1; stats.rtt_hist[last] == 0; last--)
+        ;
+    for (b = first; b <= last; b++)
+    {
+        if (b == RTT_BUCKETS - 1)  // anything longer
+            fprintf(out, "  %8ld+%-8s %ld\n", 1L << b, "", stats.rtt_hist[b]);
+        else
+            fprintf(out, "  %8ld-%-8ld %ld\n", b ? 1L << b : 0L, (1L << (b + 1)) - 1, stats.rtt_hist[b]);
+    }
+}
+
+#endif
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""
+Print a packet trace written by "udp_client4 -T" or "udp_ser4 -T" (stats.h): one line per
+event with its time relative to the first event, or a count of events per kind with --summary.
+"""
+
+import argparse
+import struct
+import sys
+
+TRACE_MAGIC = 0x34435254  # stats.h
+EVENTS = ["send", "retx", "recv", "ack-sent", "ack-recv", "timeout", "drop", "rebuilt"]
+EVENT = struct.Struct("=QIHHq")  # struct trace_so: t_ns, session, event, len, seq
+
+
+def read_trace(path):
+    """Return the events of a trace dump as (t_ns, session, event name, len, seq) tuples"""
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, size, count = struct.unpack_from("=III", data)
+    if magic != TRACE_MAGIC or size != EVENT.size:
+        raise ValueError(f"{path} is not a trace dump")
+    events = []
+    for i in range(count):
+        t_ns, session, event, length, seq = EVENT.unpack_from(data, 12 + i * size)
+        name = EVENTS[event] if event < len(EVENTS) else str(event)
+        events.append((t_ns, session, name, length, seq))
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("trace")
+    parser.add_argument("--summary", action="store_true", help="only count the events of each kind")
+    args = parser.parse_args()
+
+    events = read_trace(args.trace)
+    if not events:
+        return
+    if args.summary:
+        counts = {}
+        for _, _, name, _, _ in events:
+            counts[name] = counts.get(name, 0) + 1
+        span = (events[-1][0] - events[0][0]) / 1000
+        print(f"{len(events)} events over {span:.0f} us")
+        for name in EVENTS:
+            if name in counts:
+                print(f"{name:>10} {counts[name]:8d}")
+        return
+    start = events[0][0]
+    for t_ns, session, name, length, seq in events:
+        # Parity packets are traced with the negative of their block's first DU, minus one
+        where = f"parity@{-1 - seq}" if seq < 0 else str(seq)
+        print(f"{(t_ns - start) / 1000:12.1f} {session:08x} {name:>9} {where:>12} {length:6d}")
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except BrokenPipeError:
+        sys.stderr.close()
@@ -1,30 +1,215 @@
 #include "headsock.h"
+#include "rto.h"
+#include "cc.h"
+#include "crc32c.h"
+#include "uring.h"
+#include "fec.h"
+#include "stats.h"
+#include "timing.h"
+#include "zip.h"
+
+// A negative entry in a send list stands for parity packet j of the block of count DUs that
+// starts at DU first; last says the block ends its batch
+#define PARITY_SEQ(first, count, last, j) (-1 - ((((first) * 256 + (count)) * 2 + (last)) * FEC_MAXM + (j)))
+
+struct stream_so		//-S: what one forked sender reports to the parent through a pipe
+{
+int stream;					// which range, from 0
+uint32_t session;
+long offset;				// where the range starts in the file
+long bytes;					// file bytes of the range
+int datalen;				// negotiated payload size
+long packets, send_calls, ack_calls;
+double ms, load_ms;			// its transfer time, and how long loading its range took
+uint64_t started_ns, ended_ns;	// CLOCK_MONOTONIC at the start and the end of its transfer
+};
 
 // Function declarations
-float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len);  // Transmission function
-void tv_sub(struct  timeval *out, struct timeval *in); // Calculate the time interval between out and in
+double str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len);  // Transmission function
+double str_cli_sr(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len, int window);  // Selective-repeat transmission
+int fill_head(struct data_so *head, long lsize, long seq, int flags); // Build the header of packet number seq
+void build_msg(struct msghdr *msg, struct iovec *iov, struct data_so *head, char *buf, long lsize, long seq,
+               int flags, struct sockaddr *addr, int addrlen); // Describe packet seq as a sendmsg message
+void build_parity(struct msghdr *msg, struct iovec *iov, struct data_so *head, char *buf, long lsize, long code,
+                  int flags, struct sockaddr *addr, int addrlen); // Describe a PARITY_SEQ entry as a sendmsg message
+int fec_list(long *batch, int count, long *list); // Interleave a batch's DUs with their parity packets
+int send_seqs(int sockfd, char *buf, long lsize, long *seqs, int count, int flags, struct sockaddr *addr,
+              int addrlen); // Send the listed packets
+int send_uring(struct mmsghdr *msgs, int count); // Submit count prepared packets in one io_uring_enter
+int recv_acks(int sockfd, struct ack_so *acks, int max); // Read the pending selective-repeat ACKs
+bool ack_ok(struct ack_so *ack, int n); // Is this n byte datagram a well-formed ack_so
+int negotiate(int sockfd, struct sockaddr *addr, int addrlen, char **buf, long *lsize, int mode); // Agree on the payload size
+char *load_file(FILE *fp, long lsize); // Make the whole file addressable (malloc+fread, or mmap with -z)
+void release_file(char *buf, long lsize); // Undo load_file
+long rss_anon_kb(void); // Anonymous (heap/stack) memory currently resident
+long file_range(FILE *fp); // Bytes to send: the file, or with -S and -r the current range of it
+int fork_streams(void); // -S: fork a sender per range; returns in each child, the parent reports and exits
+double send_missing(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, int window, long *len); // -r: only what the server lacks
+unsigned char *query_map(int sockfd, struct sockaddr *addr, int addrlen, long *block); // -r: which blocks the server has
+uint32_t file_key(struct stat *st); // -r: names the file at the server from one run to the next
+
+bool use_mmsg = false;  // -m: one sendmmsg per batch/window and one recvmmsg per ACK drain
+bool zero_copy = false;  // -z: send header + slice of an mmap of the file, never copying the payload
+int datalen = DATALEN;  // -p: payload bytes per packet, lowered to what the server accepts
+struct timing_so timing;  // time spent in each phase of the transfer
+long anon_kb = 0;  // anonymous memory resident at the end of the transfer
+const char *cc_name = "reno";  // -c: congestion controller that sizes batches and the window
+FILE *cwnd_log = NULL;  // -l: congestion window over time, for plotting
+uint32_t session_id;  // names this transfer at the server, which may be serving many
+bool use_csum = false;  // -k: every packet carries a CRC32C of its header and payload
+bool hash_file = false;  // -H: the hello carries a CRC32C of the whole file, which the server checks
+bool use_zip = false;  // -Z: the packets carry the file as adaptively compressed blocks (zip.h)
+struct zip_so zip;  // -Z: what compression did
+char *image = NULL;  // -Z: the compressed image, sent in place of the file
+bool use_uring = false;  // -u: packets go out as one batch of io_uring sendmsg requests per pool
+struct uring_so ring;  // -u: the ring, with the socket as fixed file 0
+int fec_k = 0, fec_m = 0;  // -f k+m: batch mode sends fec_m Reed-Solomon parity packets per fec_k DUs
+long parity_sent = 0;  // parity packets sent, resends included
+int port = MYUDP_PORT;  // -P: the server's port (PROXY_PORT to go through udp_proxy4)
+int result_fd = -1;  // -R: also write the result here as one line of key=value pairs (for bench4)
+bool print_stats = false;  // -s: print the counters and the ACK RTT histogram at the end
+int streams = 1;  // -S: the file is split into this many ranges, each sent by its own process and socket
+int stream = 0;  // -S: the range this process sends
+long range_base = 0, range_len = 0;  // -S: the range of the file this process sends
+long file_total = 0;  // -S: the whole file's size
+uint32_t group;  // -S: names the file at the server on every stream
+int stream_fd = -1;  // -S: a forked sender writes its stream_so here
+uint64_t started_ns, ended_ns;  // when the transfer began and ended, so the streams can be timed together
+bool resume = false;  // -r: ask the server which blocks of the file it has stored and send only the others
 
 int main(int argc, char **argv)
 {
     // Socket and network variables
     int sockfd;                    // Socket file descriptor
-    float ti, rt;                       // ti = transmission time (ms), rt = data rate
+    double ti, rt;                      // ti = transmission time (ms), rt = data rate
     long len;                           // Total bytes transmitted
     struct sockaddr_in ser_addr;        // Server address structure
     char **pptr;                        // Pointer for iterating through aliases
     struct hostent *sh;                 // Host entity structure from DNS lookup
     struct in_addr **addrs;             // Array of IP addresses
     FILE *fp;                           // File pointer for the file to send
+    int opt;                            // Current command line option
+    int window = 0;                     // Selective-repeat window size (0 = classic 1-2-3 batches)
+    int bufsize = SOCKBUF;              // Socket send buffer, big enough for a window of large datagrams
+    struct rusage usage;                // Peak memory of the run
+    struct stat st;                     // The file, with -S or -r
+
+    timing_init(&timing);
+
+    // Parse options: -w <n> switches to selective repeat with n packets in flight
+    while ((opt = getopt(argc, argv, "w:mzp:c:l:kHZuf:P:R:sT:S:r")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                cc_name = optarg;
+                break;
+            case 'l':
+                cwnd_log = fopen(optarg, "w");
+                if (cwnd_log == NULL)
+                {
+                    printf("Cannot open %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'p':
+                datalen = atoi(optarg);
+                if (datalen < MINDATALEN || datalen > MAXDATALEN)
+                {
+                    printf("Payload size must be between %d and %d\n", MINDATALEN, MAXDATALEN);
+                    exit(1);
+                }
+                break;
+            case 'z':
+                zero_copy = true;
+                break;
+            case 'k':
+                use_csum = true;
+                break;
+            case 'H':
+                hash_file = true;
+                break;
+            case 'Z':
+                use_zip = true;
+                break;
+            case 'm':
+                use_mmsg = true;
+                break;
+            case 'u':
+                use_uring = true;
+                break;
+            case 'P':
+                port = atoi(optarg);
+                break;
+            case 'R':
+                result_fd = atoi(optarg);
+                break;
+            case 's':
+                print_stats = true;
+                break;
+            case 'r':
+                resume = true;
+                break;
+            case 'S':
+                streams = atoi(optarg);
+                if (streams < 1 || streams > MAXSTREAMS)
+                {
+                    printf("Streams must be between 1 and %d\n", MAXSTREAMS);
+                    exit(1);
+                }
+                break;
+            case 'T':
+                if (trace_open(optarg) == -1)
+                {
+                    exit(2);
+                }
+                break;
+            case 'f':
+                if (sscanf(optarg, "%d+%d", &fec_k, &fec_m) != 2 || fec_k < 1 || fec_k > FEC_MAXK ||
+                    fec_m < 1 || fec_m > FEC_MAXM)
+                {
+                    printf("FEC must be k+m with k between 1 and %d and m between 1 and %d\n", FEC_MAXK, FEC_MAXM);
+                    exit(1);
+                }
+                break;
+            case 'w':
+                window = atoi(optarg);
+                if (window < 1 || window > MAXWINDOW)
+                {
+                    printf("Window must be between 1 and %d\n", MAXWINDOW);
+                    exit(1);
+                }
+                break;
+            default:
+                printf("Usage: %s [-w window | -f k+m] [-m] [-u] [-z] [-k] [-H] [-Z] [-p payload] [-c reno|vegas|fixed] [-l cwnd.log] [-P port] [-R result fd] [-s] [-T trace.bin] [-S streams] [-r] hostname\n",
+                       argv[0]);
+                exit(1);
+        }
+    }
 
     // Check command line arguments: program requires hostname as parameter
-    if (argc != 2) 
+    if (argc - optind != 1) 
     {
         printf("Parameters do not match");
         exit(1);
     }
+    if (fec_m > 0)
+    {
+        if (window > 0)
+        {
+            printf("FEC protects batches; selective repeat (-w) resends on its own\n");
+            exit(1);
+        }
+        // A parity packet carries fec_so in front of a full payload
+        if (datalen > MAXDATALEN - FECHEADLEN)
+        {
+            datalen = MAXDATALEN - FECHEADLEN;
+        }
+        fec_init();
+    }
 
     // Resolve hostname to IP address using DNS
-    sh = gethostbyname(argv[1]);
+    sh = gethostbyname(argv[optind]);
     if (sh == NULL) 
     {
         printf("Cannot get host name");
@@ -50,6 +235,22 @@ int main(int argc, char **argv)
             break;
     }
 
+    // -S and -r send ranges of the file: the whole of it, until split or found partly stored
+    if (streams > 1 || resume)
+    {
+        if (stat("bigfile.bin", &st) == -1)
+        {
+            printf("File doesn't exit\n");
+            exit(0);
+        }
+        file_total = range_len = st.st_size;
+        group = resume ? file_key(&st) : 0;
+    }
+    if (streams > 1)
+    {
+        stream_fd = fork_streams();
+    }
+
     // Open file to send
     if ((fp = fopen ("bigfile.bin","rb")) == NULL) 
     {
@@ -66,28 +267,368 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    if (use_uring && (uring_init(&ring, URING_DEPTH) == -1 || uring_register_files(&ring, &sockfd, 1) == -1))
+    {
+        printf("Error in io_uring setup: %s\n", strerror(errno));
+        exit(1);
+    }
+
     // Configure server address structure
     ser_addr.sin_family = AF_INET;                                          // IPv4 protocol
-    ser_addr.sin_port = htons(MYUDP_PORT);                                  // Server port (convert to network byte order)
+    ser_addr.sin_port = htons(port);                                  // Server port (convert to network byte order)
     memcpy(&(ser_addr.sin_addr.s_addr), *addrs, sizeof(struct in_addr));   // Copy IP address from DNS result
     bzero(&(ser_addr.sin_zero), 8); // bzero() zeroes specified number of bytes starting from front to back
 
-    // Perform the transmission and receiving using varying-batch-size protocol
-    ti = str_cli(fp, sockfd, (struct sockaddr *)&ser_addr, sizeof(struct sockaddr_in), &len);
+    // Any id will do as long as concurrent transfers from this address pick different ones
+    srandom(getpid() ^ now_us());
+    session_id = random();
+    printf("session %08x\n", session_id);
+
+    // Perform the transmission and receiving using varying-batch-size or selective-repeat protocol
+    if (cc_find(cc_name) == NULL)
+    {
+        printf("Unknown congestion controller %s\n", cc_name);
+        exit(1);
+    }
+    if (resume)
+    {
+        ti = send_missing(fp, sockfd, (struct sockaddr *)&ser_addr, sizeof(struct sockaddr_in), window, &len);
+    }
+    else if (window > 0)
+    {
+        ti = str_cli_sr(fp, sockfd, (struct sockaddr *)&ser_addr, sizeof(struct sockaddr_in), &len, window);
+    }
+    else
+    {
+        ti = str_cli(fp, sockfd, (struct sockaddr *)&ser_addr, sizeof(struct sockaddr_in), &len);
+    }
     
+    if (cwnd_log != NULL)
+    {
+        fclose(cwnd_log);
+    }
+    // Clean up resources
+    close(sockfd);   // Close socket
+    fclose(fp);      // Close file
+    timing_phase(&timing, -1);
+    if (ti < 0)
+    {
+        exit(1);
+    }
+
+    // With -Z the rate that counts is of file bytes, however few went on the wire
+    if (use_zip)
+    {
+        printf("Compression: %ld file bytes sent as %ld (ratio %.2f), %ld of %ld blocks deflated, %ld skipped on entropy\n",
+               zip.raw, zip.wire, zip.wire ? (double)zip.raw / zip.wire : 1.0, zip.packed, zip.blocks, zip.skipped);
+        printf("Wire rate: %f (Kbytes/s), goodput gain %.2fx\n", zip.wire / ti, zip.wire ? (double)zip.raw / zip.wire : 1.0);
+        len = zip.raw;
+    }
+
     // Calculate the average transmission rate (bytes per millisecond = Kbytes/s)
-    rt = (len/(float)ti);
+    rt = ti > 0 ? len / ti : 0;   // -r: there may have been nothing left to send
     
     // Display transmission statistics
+    printf("Send syscalls: %ld for %ld packets (%.2f per call), ACK syscalls: %ld for %ld ACKs (%.2f per call)\n",
+           stats.send_calls, stats.send_pkts, stats.send_calls ? (float)stats.send_pkts / stats.send_calls : 0.0,
+           stats.recv_calls, stats.recv_pkts, stats.recv_calls ? (float)stats.recv_pkts / stats.recv_calls : 0.0);
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Load(ms) : %.3f, Peak RSS(KB): %ld, Anonymous RSS(KB): %ld\n", timing_ms(&timing, PH_LOAD), usage.ru_maxrss,
+           anon_kb);
+    if (fec_m > 0)
+    {
+        printf("FEC %d+%d: %ld parity packets sent\n", fec_k, fec_m, parity_sent);
+    }
     printf("Time(ms) : %.3f, Data sent(byte): %ld\nData rate: %f (Kbytes/s)\n", ti, (long)len, rt);
-    
-    // Clean up resources
-    close(sockfd);   // Close socket
-    fclose(fp);      // Close file
+    timing_print(&timing);
+    if (print_stats)
+    {
+        stats_print(stdout);
+    }
+    if (result_fd != -1)
+    {
+        dprintf(result_fd, "session=%08x time_ms=%.3f bytes=%ld datalen=%d packets=%ld send_calls=%ld ack_calls=%ld load_ms=%.3f\n",
+                session_id, ti, len, datalen, stats.send_pkts, stats.send_calls, stats.recv_calls,
+                timing_ms(&timing, PH_LOAD));
+    }
+    if (stream_fd != -1)
+    {
+        struct stream_so report = {stream, session_id, range_base, len, datalen, stats.send_pkts, stats.send_calls,
+                                   stats.recv_calls, ti, timing_ms(&timing, PH_LOAD), started_ns, ended_ns};
+
+        if (write(stream_fd, &report, sizeof(report)) != sizeof(report))
+        {
+            exit(1);
+        }
+    }
     exit(0);
 }
 
-float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len) 
+// -S: the file is cut into streams ranges of whole compression blocks, and each is sent by a
+// forked copy of this program with its own socket and session, exactly as a file of its own
+// would be; the hello tells the server where in the shared output file the range goes. Forked
+// senders rather than threads, like udp_ser4 -w, since a transfer's state is global. Their
+// output goes to stderr; the parent collects a stream_so from each through a pipe and prints
+// the aggregate, timed from the first stream's start to the last one's end.
+int fork_streams(void)
+{
+    struct stream_so reports[MAXSTREAMS], r;
+    pid_t pids[MAXSTREAMS];
+    long range, len = 0, packets = 0, send_calls = 0, ack_calls = 0;
+    uint64_t first = 0, last = 0;
+    double ti, load_ms = 0;
+    bool got[MAXSTREAMS] = {false}, failed = false;
+    int pipefd[2], i, status;
+
+    range = (file_total + streams - 1) / streams;
+    // -r: ranges of whole checkpoint blocks, so every block is stored by one stream alone
+    range = resume ? (range + RESUME_BLOCK - 1) / RESUME_BLOCK * RESUME_BLOCK : (range + ZBLOCK - 1) / ZBLOCK * ZBLOCK;
+    srandom(getpid() ^ now_us());
+    if (!resume)
+    {
+        group = random();
+    }
+    printf("%ld bytes in %d streams of up to %ld bytes, bigfilereceive-%08x.bin\n", file_total, streams, range, group);
+    if (pipe(pipefd) == -1)
+    {
+        printf("Error in pipe\n");
+        exit(1);
+    }
+    fflush(stdout);
+    for (i = 0; i < streams; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == -1)
+        {
+            printf("Error in fork\n");
+            exit(1);
+        }
+        if (pids[i] == 0)
+        {
+            close(pipefd[0]);
+            stream = i;
+            range_base = i * range < file_total ? i * range : file_total;
+            range_len = file_total - range_base < range ? file_total - range_base : range;
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+            result_fd = -1;
+            if (i > 0)
+            {
+                cwnd_log = NULL;   // stream 0 logs and traces for all
+                trace_ring = NULL;
+            }
+            return pipefd[1];
+        }
+    }
+    close(pipefd[1]);
+    cwnd_log = NULL;   // stream 0's; the parent sends nothing and must not overwrite them at exit
+    trace_ring = NULL;
+
+    while (read(pipefd[0], &r, sizeof(r)) == sizeof(r))
+    {
+        if (r.stream >= 0 && r.stream < streams)
+        {
+            reports[r.stream] = r;
+            got[r.stream] = true;
+        }
+    }
+    close(pipefd[0]);
+    for (i = 0; i < streams; i++)
+    {
+        if (waitpid(pids[i], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !got[i])
+        {
+            printf("Stream %d failed\n", i);
+            failed = true;
+            continue;
+        }
+        r = reports[i];
+        printf("Stream %d: session %08x, %ld bytes at offset %ld, %.3f ms, %.1f Mbit/s, %d byte packets, %ld packets\n",
+               i, r.session, r.bytes, r.offset, r.ms, r.ms > 0 ? r.bytes * 8 / r.ms / 1000 : 0, r.datalen, r.packets);
+        len += r.bytes;
+        packets += r.packets;
+        send_calls += r.send_calls;
+        ack_calls += r.ack_calls;
+        load_ms = r.load_ms > load_ms ? r.load_ms : load_ms;
+        first = first == 0 || r.started_ns < first ? r.started_ns : first;
+        last = r.ended_ns > last ? r.ended_ns : last;
+    }
+    if (failed)
+    {
+        exit(1);
+    }
+    ti = (last - first) / 1e6;
+    printf("Send syscalls: %ld for %ld packets, ACK syscalls: %ld\n", send_calls, packets, ack_calls);
+    printf("Time(ms) : %.3f, Data sent(byte): %ld\nData rate: %f (Kbytes/s)\n", ti, len, ti > 0 ? len / ti : 0);
+    if (result_fd != -1)
+    {
+        dprintf(result_fd, "session=%08x time_ms=%.3f bytes=%ld datalen=%d packets=%ld send_calls=%ld ack_calls=%ld load_ms=%.3f\n",
+                group, ti, len, reports[0].datalen, packets, send_calls, ack_calls, load_ms);
+    }
+    exit(0);
+}
+
+// -r: ask for the server's map of the file and send every run of blocks missing from our range
+// (all of the file, or our stream's) as a transfer of its own, into the same output file.
+// Each is checkpointed as it goes, so one that is cut off again is resumed from there next time.
+double send_missing(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, int window, long *len)
+{
+    unsigned char *have;
+    long block, from = range_base, to = range_base + range_len, b, end, n, stored = 0;
+    struct zip_so sum;
+    double ti = 0;
+    int runs = 0;
+
+    have = query_map(sockfd, addr, addrlen, &block);
+    if (have == NULL)
+    {
+        printf("The server does not answer the resume query\n");
+        return -1;
+    }
+    memset(&sum, 0, sizeof(sum));
+    *len = 0;
+    // At least one run, so an empty range still gets its (empty) session and its file
+    b = from / block;
+    do
+    {
+        for (end = b + 1; end * block < to && have[end] == have[b]; end++)
+            ;
+        range_base = b * block > from ? b * block : from;
+        range_len = (end * block < to ? end * block : to) - range_base;
+        if (have[b])
+        {
+            stored += range_len;
+            continue;
+        }
+        session_id = random();
+        printf("session %08x: bytes %ld to %ld\n", session_id, range_base, range_base + range_len);
+        ti = window > 0 ? str_cli_sr(fp, sockfd, addr, addrlen, &n, window) : str_cli(fp, sockfd, addr, addrlen, &n);
+        if (ti < 0)
+        {
+            break;
+        }
+        *len += n;
+        runs++;
+        sum.raw += zip.raw;
+        sum.wire += zip.wire;
+        sum.blocks += zip.blocks;
+        sum.skipped += zip.skipped;
+        sum.packed += zip.packed;
+    } while ((b = end) * block < to);
+    if (ti < 0)
+    {
+        printf("Resume failed: bytes %ld to %ld were not sent, %d ranges sent before them\n", range_base,
+               range_base + range_len, runs);
+    }
+    else
+    {
+        printf("Resumed: %ld of %ld bytes were stored already, %d ranges sent\n", stored, to - from, runs);
+    }
+    range_base = from;
+    range_len = to - from;
+    zip = sum;
+    free(have);
+    return ti;   // the phases add up over the ranges
+}
+
+// -r: the server's map, a byte per block of file_total (1 = stored), asked for 8192 blocks at a
+// time; NULL if it does not answer
+unsigned char *query_map(int sockfd, struct sockaddr *addr, int addrlen, long *block)
+{
+    struct hello_so query;
+    struct resume_so reply;
+    struct rto_so rto;
+    struct pollfd pfd;
+    unsigned char *have = NULL;
+    long blocks = 1, first = 0, i, sent, wait;
+    int n;
+
+    memset(&query, 0, sizeof(query));
+    query.magic = HELLO_MAGIC;
+    query.version = WIRE_VERSION;
+    query.mode = MODE_QUERY;
+    query.session = session_id;
+    query.total = file_total;
+    query.group = group;
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    do
+    {
+        query.base = (uint64_t)first * RESUME_BLOCK;
+        rto_init(&rto);
+        n = 0;
+        while (n <= 0)
+        {
+            if (sendto(sockfd, &query, sizeof(query), 0, addr, addrlen) == -1)
+            {
+                free(have);
+                return NULL;
+            }
+            sent = now_us();
+            do
+            {
+                wait = sent + rto.rto - now_us();
+                n = poll(&pfd, 1, wait > 0 ? (wait + 999) / 1000 : 0);
+                if (n > 0)
+                {
+                    n = recvfrom(sockfd, &reply, sizeof(reply), 0, NULL, NULL);
+                    if (n >= RESUMEHEADLEN && reply.magic == RESUME_MAGIC && reply.session == query.session &&
+                        reply.first == first && n >= RESUMEHEADLEN + ((long)reply.count + 7) / 8)
+                    {
+                        break;
+                    }
+                    n = 1;   // not the answer: keep waiting
+                }
+            } while (n > 0);
+            if (n <= 0 && rto_backoff(&rto) == -1)
+            {
+                free(have);
+                return NULL;
+            }
+        }
+        if (have == NULL)
+        {
+            blocks = reply.blocks;
+            *block = reply.block;
+            have = calloc(blocks + 1, 1);
+            if (have == NULL)
+            {
+                exit(2);
+            }
+        }
+        for (i = 0; i < reply.count && first + i < blocks; i++)
+        {
+            have[first + i] = reply.map[i / 8] >> (i % 8) & 1;
+        }
+        first += reply.count;
+    } while (first < blocks && reply.count > 0);
+    return have;
+}
+
+uint32_t file_key(struct stat *st)
+{
+    int64_t id[2] = {st->st_size, st->st_mtime};
+
+    return crc32c(crc32c(0, "bigfile.bin", 11), id, sizeof(id));
+}
+
+// fp is left where the bytes to send start
+long file_range(FILE *fp)
+{
+    long lsize;
+
+    if (streams > 1 || resume)
+    {
+        fseek(fp, range_base, SEEK_SET);
+        return range_len;
+    }
+    fseek(fp, 0, SEEK_END);
+    lsize = ftell(fp);
+    rewind(fp);
+    return lsize;
+}
+
+double str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len)
 {
 	// Buffer and file handling variables
 	char *buf;                          // Pointer to buffer that will hold entire file
@@ -95,123 +636,921 @@ float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *le
 	
 	// Network packet structures
 	struct ack_so ack;                  // Structure to receive acknowledgments from server
-    struct pack_so pack_sends;          // Structure for data packets (contains header + data)
 	
 	// Transmission control variables
-	int n, slen;                        // n = bytes sent/received, slen = size of current packet's data
-    int batch_size = 1;                 // Current batch size (will cycle 1 -> 2 -> 3 -> 1)
+	int n;                              // n = bytes sent/received
+    struct cc_so cc;                    // Congestion controller, sizes each batch
     int du_in_batch = 0;                // Counter: how many DUs sent in current batch
+    long batch[MAXWINDOW];              // Sequence numbers of the DUs in the current batch
+    static long list[MAXWINDOW * (1 + FEC_MAXM)];  // The batch as sent: its DUs, with -f their parity too
+    int nlist;                          // Entries of list
+    long seq;                           // Sequence number of the batch's last DU
+    bool resent;                        // Batch was retransmitted, so its ACK is no RTT sample (Karn)
 	
-	// Timing variables
-	float time_inv = 0.0;               // Will store transmission time in milliseconds
-	struct timeval sendt, recvt;        // Timestamps for start and end of transmission
+	// Retransmission timer
+    struct rto_so rto;                  // Smoothed RTT / variance estimator that sets the timeout
+    struct pollfd pfd;                  // Used to wait for the ACK no longer than the timeout
+    long batch_sent, wait;              // When the batch was (re)sent, and time left on its timer (us)
+	double time_inv;                    // Transmission time in milliseconds
 	
-    socklen_t from_len;
 	ci = 0;  // Initialize current index to start of file
+    rto_init(&rto);
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
 
-    // Determine file size by seeking to end
-    fseek(fp , 0 , SEEK_END);           // Move file pointer to end
-	lsize = ftell(fp);                  // Get current position (which is the file size)
-	rewind(fp);                         // Move file pointer back to beginning
+    // Determine file size (with -S, the size of our range)
+	lsize = file_range(fp);
 	
-	// Display file and packet information
-	printf("The file length is %d bytes\n", (int)lsize);
-	printf("the packet length is %d bytes\n",DATALEN);
+	// Display file information
+	printf("The file length is %ld bytes\n", lsize);
 
-    // Allocate memory to contain the whole file
-	buf = (char *) malloc(lsize + 1);
-	if (buf == NULL) 
-    {
-        exit(2);
-    }
-    
-    // Read entire file into buffer
-    fread(buf, 1, lsize, fp); // Read 'lsize' bytes from file into buf
-    buf[lsize] = '\0';  // Null-terminate the buffer
+    // Make the whole file addressable
+    timing_phase(&timing, PH_LOAD);
+    buf = load_file(fp, lsize);
+    cc_init(&cc, cc_name, MAXWINDOW, cwnd_log);
     
     // Start timing the transmission
-    gettimeofday(&sendt, NULL);
+    timing_phase(&timing, PH_FIRST);
+    started_ns = started_ns ? started_ns : mono_ns();   // -r: the first range's
+
+    // Agree on the packet size with the server before the first DU; from here on buf and
+    // lsize are the compressed image with -Z
+    if (negotiate(sockfd, addr, addrlen, &buf, &lsize, MODE_BATCH) == -1)
+    {
+        printf("Server not responding, giving up\n");
+        release_file(buf, lsize);
+        return -1;
+    }
+	printf("the packet length is %d bytes\n", datalen);
     
     // Main transmission loop
-    while (ci <= lsize) {
-        // Determine size of this packet's data
-        if ((lsize + 1 - ci) <= DATALEN) 
+    while (ci < lsize) {
+        // Gather the DUs of this batch: as many as the congestion window allows, fewer at
+        // the end of the file. The last one is flagged PKT_EOB so the server knows when to ACK.
+        du_in_batch = 0;
+        while (du_in_batch < cc_window(&cc) && ci < lsize)
+        {
+            batch[du_in_batch++] = ci / datalen;   // Sequence number (which packet this is)
+            ci += (lsize - ci < datalen) ? lsize - ci : datalen;
+        }
+        seq = batch[du_in_batch - 1];
+        nlist = fec_list(batch, du_in_batch, list);
+        batch_sent = now_us();
+        resent = false;
+        if (send_seqs(sockfd, buf, lsize, list, nlist, PKT_EOB, addr, addrlen) == -1) 
+        {
+            printf("Send error!\n");
+            release_file(buf, lsize);
+            return -1;
+        }
+
+        // wait for ack, resending the whole batch each time the timer runs out
+        timing_phase(&timing, PH_ACK_WAIT);
+        while (1)
+        {
+            wait = batch_sent + rto.rto - now_us();
+            n = poll(&pfd, 1, wait > 0 ? (wait + 999) / 1000 : 0);
+            if (n == -1)
+            {
+                printf("Poll error!\n");
+                release_file(buf, lsize);
+                return -1;
+            }
+            if (n > 0)
+            {
+                n = recvfrom(sockfd, &ack, sizeof(ack), 0, NULL, NULL);
+                if (n == -1) 
+                {
+                    printf("Receive ACK error!\n");
+                    release_file(buf, lsize);
+                    return -1;
+                }
+                stats.recv_calls++;
+                stats.recv_pkts++;
+                // The batch is acknowledged cumulatively up to its last DU; anything else is
+                // a late duplicate ACK for an earlier batch
+                if (ack_ok(&ack, n) && ack.cum == seq + 1)
+                {
+                    trace(TR_ACK_RECV, session_id, ack.cum, n);
+                    break;
+                }
+                continue;
+            }
+            trace(TR_TIMEOUT, session_id, seq, 0);
+            if (rto_backoff(&rto) == -1)
+            {
+                printf("Server not responding, giving up\n");
+                release_file(buf, lsize);
+                return -1;
+            }
+            // The server waits for this exact batch, so only the next one gets smaller
+            cc_timeout(&cc, seq + 1);
+            if (send_seqs(sockfd, buf, lsize, list, nlist, PKT_EOB | PKT_RETX, addr, addrlen) == -1)
+            {
+                printf("Send error!\n");
+                release_file(buf, lsize);
+                return -1;
+            }
+            batch_sent = now_us();
+            resent = true;
+        }
+        if (!resent)
+        {
+            rto_sample(&rto, now_us() - batch_sent);
+            stats_rtt(now_us() - batch_sent);
+        }
+        rto.retries = 0;
+        timing_phase(&timing, PH_STEADY);
+
+        // Size the next batch from this ACK
+        cc_ack(&cc, du_in_batch, resent ? 0 : now_us() - batch_sent);
+    }
+
+    timing_phase(&timing, PH_TEARDOWN);
+    ended_ns = mono_ns();
+    *len = ci;
+    time_inv = timing_transfer_ms(&timing);
+
+    release_file(buf, lsize);
+    return time_inv;
+}
+
+double str_cli_sr(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len, int window)
+{
+    char *buf;                          // Whole file, loaded before timing starts
+    long lsize;                         // Total file size
+    long npkts;                         // Number of datalen packets the file splits into
+    long base = 0;                      // Oldest unacknowledged sequence number
+    long next = 0;                      // Next sequence number never sent before
+    long seq;                           // Loop variable over the window
+    long earliest;                      // Soonest retransmission deadline in the window
+    long now;
+    long retransmits = 0;               // Packets sent more than once
+    long fast = 0;                      // ... of which resent on SACK evidence rather than a timeout
+    long newest;                        // Highest packet an ACK newly covered, -1 if none
+    long highest = -1;                  // Highest packet known to have arrived
+    long bit;                           // Loop variable over a SACK bitmap
+    long outstanding = 0;               // Packets sent and not acknowledged yet
+    int newly;                          // Packets one ACK newly covered
+    struct cc_so cc;                    // Congestion controller, limits outstanding below the window
+    char *acked;                        // acked[seq] = 1 once the server confirmed seq
+    char *resent;                       // resent[seq] = 1 if seq went out more than once (Karn)
+    long *sent_at;                      // sent_at[seq] = time (us) seq was last transmitted
+    struct rto_so rto;                  // Adaptive retransmission timeout
+    long *seqs;                         // Sequence numbers handed to one send_seqs() call
+    struct ack_so *acks;                // Cumulative + selective acknowledgments drained in one go
+    struct pollfd pfd;                  // Used to wait for an ACK with a timeout
+    int n, i, count;
+    double time_inv;
+
+    lsize = file_range(fp);
+    printf("The file length is %ld bytes\n", lsize);
+    timing_phase(&timing, PH_LOAD);
+    buf = load_file(fp, lsize);
+
+    timing_phase(&timing, PH_FIRST);
+    started_ns = started_ns ? started_ns : mono_ns();   // -r: the first range's
+
+    // Agree on the packet size with the server; the file size travels in the hello,
+    // so an empty file needs no data packets at all. With -Z buf and lsize are the
+    // compressed image from here on.
+    if (negotiate(sockfd, addr, addrlen, &buf, &lsize, MODE_SR) == -1)
+    {
+        printf("Server not responding, giving up\n");
+        release_file(buf, lsize);
+        return -1;
+    }
+    npkts = (lsize + datalen - 1) / datalen;
+    printf("the packet length is %d bytes, window is %d packets\n", datalen, window);
+    acked = (char *) calloc(npkts + 1, sizeof(char));
+    resent = (char *) calloc(npkts + 1, sizeof(char));
+    sent_at = (long *) calloc(npkts + 1, sizeof(long));
+    seqs = (long *) malloc(window * sizeof(long));
+    acks = (struct ack_so *) malloc(window * sizeof(struct ack_so));
+    if (acked == NULL || resent == NULL || sent_at == NULL || seqs == NULL || acks == NULL)
+    {
+        exit(2);
+    }
+
+    rto_init(&rto);
+    cc_init(&cc, cc_name, window, cwnd_log);
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+
+    while (base < npkts)
+    {
+        // Send new packets while the congestion window has room; the window (-w) still bounds
+        // how far ahead of the oldest missing packet we may go, which the receiver relies on
+        for (count = 0; next + count < npkts && next + count < base + window && outstanding + count < cc_window(&cc);
+             count++)
+        {
+            seqs[count] = next + count;
+        }
+        if (count > 0)
+        {
+            if (send_seqs(sockfd, buf, lsize, seqs, count, 0, addr, addrlen) == -1)
+            {
+                printf("Send error!\n");
+                goto fail;
+            }
+            now = now_us();
+            for (i = 0; i < count; i++)
+            {
+                sent_at[seqs[i]] = now;
+            }
+            next += count;
+            outstanding += count;
+        }
+
+        // Wait for an ACK, but no longer than the oldest outstanding packet's timer
+        now = now_us();
+        earliest = now + rto.rto;
+        for (seq = base; seq < next; seq++)
         {
-            slen = lsize + 1 - ci; // Last packet: send remaining bytes
+            if (!acked[seq] && sent_at[seq] + rto.rto < earliest)
+            {
+                earliest = sent_at[seq] + rto.rto;
+            }
         }
-        else
+        timing_phase(&timing, PH_ACK_WAIT);
+        n = poll(&pfd, 1, earliest > now ? (earliest - now + 999) / 1000 : 0);
+        timing_phase(&timing, PH_STEADY);
+        if (n == -1)
         {
-            slen = DATALEN; // Regular packet: send full DATALEN bytes
+            printf("Poll error!\n");
+            goto fail;
         }
 
-        // Fill packet structure
-        pack_sends.num = ci / DATALEN;              // Sequence number (which packet this is)
-        pack_sends.len = lsize;                     // Total file length (server needs this)
-        memcpy(pack_sends.data, (buf + ci), slen); // Copy data from file buffer to packet
+        if (n > 0)
+        {
+            count = recv_acks(sockfd, acks, window);
+            if (count == -1)
+            {
+                printf("Receive ACK error!\n");
+                goto fail;
+            }
+            now = now_us();
+            for (i = 0; i < count; i++)
+            {
+                trace(TR_ACK_RECV, session_id, acks[i].cum, ACKHEADLEN + acks[i].len * 8);
+                // Everything below cum arrived, plus whatever the bitmap marks after it
+                newest = -1;
+                newly = 0;
+                for (seq = base; seq < acks[i].cum && seq < next; seq++)
+                {
+                    if (!acked[seq])
+                    {
+                        acked[seq] = 1;
+                        newest = seq;
+                        newly++;
+                    }
+                }
+                for (bit = 0; bit < acks[i].len * 64; bit++)
+                {
+                    seq = acks[i].cum + 1 + bit;
+                    if (seq >= next)
+                    {
+                        break;
+                    }
+                    if ((acks[i].sack[bit / 64] & (1ULL << (bit % 64))) && !acked[seq])
+                    {
+                        acked[seq] = 1;
+                        newest = seq;
+                        newly++;
+                    }
+                }
+                if (newest < 0)
+                {
+                    continue;   // a stale or duplicate ACK
+                }
+                if (newest > highest)
+                {
+                    highest = newest;
+                }
+                // The packet that completed this ACK is the one its timing belongs to
+                if (!resent[newest])
+                {
+                    rto_sample(&rto, now - sent_at[newest]);
+                    stats_rtt(now - sent_at[newest]);
+                }
+                rto.retries = 0; // the server is alive, even if the sample was not usable
+                outstanding -= newly;
+                cc_ack(&cc, newly, resent[newest] ? 0 : now - sent_at[newest]);
+            }
+            // Slide the window past every packet that has been acknowledged
+            while (base < npkts && acked[base])
+            {
+                base++;
+            }
 
-        // Send packet via UDP
-        n = sendto(sockfd, &pack_sends, slen + HEADLEN, 0, addr, addrlen);
-        if (n == -1) 
+            // A hole with DUPTHRESH acknowledged packets after it was lost, not delayed:
+            // resend it now instead of waiting for its timer. A packet that was already resent
+            // stays on its timer, since the packets acked after it may predate the resend.
+            count = 0;
+            for (seq = base; seq + DUPTHRESH <= highest; seq++)
+            {
+                if (acked[seq] || (resent[seq] && now - sent_at[seq] < rto.rto))
+                {
+                    continue;
+                }
+                seqs[count++] = seq;
+                sent_at[seq] = now;
+                resent[seq] = 1;
+                cc_loss(&cc, seq, next);
+            }
+            if (count > 0)
+            {
+                if (send_seqs(sockfd, buf, lsize, seqs, count, PKT_RETX, addr, addrlen) == -1)
+                {
+                    printf("Send error!\n");
+                    goto fail;
+                }
+                retransmits += count;
+                fast += count;
+            }
+            continue;
+        }
+
+        // Timer expired: resend only the packets whose ACK has not arrived
+        now = now_us();
+        count = 0;
+        for (seq = base; seq < next; seq++)
+        {
+            if (acked[seq] || sent_at[seq] + rto.rto > now)
+            {
+                continue;
+            }
+            seqs[count++] = seq;
+            sent_at[seq] = now;
+            resent[seq] = 1;
+        }
+        if (send_seqs(sockfd, buf, lsize, seqs, count, PKT_RETX, addr, addrlen) == -1)
         {
             printf("Send error!\n");
-            free(buf);
-            return -1;
+            goto fail;
+        }
+        retransmits += count;
+        if (count > 0)
+        {
+            trace(TR_TIMEOUT, session_id, base, 0);
+        }
+        // One backoff per timeout event, however many packets it covered
+        if (count > 0 && rto_backoff(&rto) == -1)
+        {
+            printf("Server not responding, giving up\n");
+            goto fail;
+        }
+        if (count > 0)
+        {
+            cc_timeout(&cc, next);
         }
+    }
 
-        ci += slen;
-        du_in_batch++; // increment DU count in batch
+    timing_phase(&timing, PH_TEARDOWN);
+    ended_ns = mono_ns();
+    *len = lsize;
+    printf("Retransmitted %ld of %ld packets (%ld fast), srtt %ld us, rto %ld us, %s cwnd %d\n",
+           retransmits, npkts, fast, rto.srtt, rto.rto, cc.ops->name, cc_window(&cc));
+
+    time_inv = timing_transfer_ms(&timing);
+
+    release_file(buf, lsize);
+    free(acked);
+    free(resent);
+    free(sent_at);
+    free(seqs);
+    free(acks);
+    return time_inv;
+
+fail:
+    release_file(buf, lsize);
+    free(acked);
+    free(resent);
+    free(sent_at);
+    free(seqs);
+    free(acks);
+    return -1;
+}
+
+// Fill in the v2 header of packet seq and return the payload length. flags are the caller's
+// (PKT_RETX, PKT_EOB); position and checksum flags are added here.
+int fill_head(struct data_so *head, long lsize, long seq, int flags)
+{
+    int slen;
+
+    // The last packet carries whatever is left of the file
+    slen = (lsize - seq * datalen < datalen) ? lsize - seq * datalen : datalen;
+    head->version = WIRE_VERSION;
+    head->flags = flags | (seq == 0 ? PKT_FIRST : 0) | (seq * datalen + slen == lsize ? PKT_LAST : 0) |
+                  (use_csum ? PKT_CSUM : 0);
+    head->len = slen;
+    head->session = session_id;
+    head->offset = (uint64_t)seq * datalen;
+    stats.packets++;
+    stats.bytes += slen;
+    stats.retransmits += (flags & PKT_RETX) != 0;
+    trace(flags & PKT_RETX ? TR_RETX : TR_SEND, session_id, seq, slen);
+    return slen;
+}
+
+// Describe packet seq in msg. Normally the payload is copied in after the header; with -z
+// only the header is built and the payload is a second iovec pointing into the file mapping.
+// The checksum covers the header and the payload, and sits between them.
+void build_msg(struct msghdr *msg, struct iovec *iov, struct data_so *head, char *buf, long lsize, long seq,
+               int flags, struct sockaddr *addr, int addrlen)
+{
+    int slen, hlen;
+    char *data = buf + seq * datalen;
+    uint32_t crc;
+
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = addr;
+    msg->msg_namelen = addrlen;
+    msg->msg_iov = iov;
+    slen = fill_head(head, lsize, seq, flags);
+    hlen = use_csum ? WIREHEADLEN + CSUMLEN : WIREHEADLEN;
+    if (use_csum)
+    {
+        crc = crc32c(crc32c(0, head, WIREHEADLEN), data, slen);
+        memcpy((char *)head + WIREHEADLEN, &crc, CSUMLEN);
+    }
+    iov[0].iov_base = head;
+    if (zero_copy)
+    {
+        iov[0].iov_len = hlen;
+        iov[1].iov_base = data;
+        iov[1].iov_len = slen;
+        msg->msg_iovlen = 2;
+    }
+    else
+    {
+        memcpy((char *)head + hlen, data, slen);
+        iov[0].iov_len = hlen + slen;
+        msg->msg_iovlen = 1;
+    }
+}
+
+// Describe the parity packet a PARITY_SEQ code stands for in msg. The parity is computed
+// from the block's DUs in the file buffer, into the packet after its fec_so. It is flagged
+// PKT_EOB when its block ends the batch, so the server learns the batch size even when the
+// batch's last DU is lost.
+void build_parity(struct msghdr *msg, struct iovec *iov, struct data_so *head, char *buf, long lsize, long code,
+                  int flags, struct sockaddr *addr, int addrlen)
+{
+    uint8_t *data[FEC_MAXK];
+    int lens[FEC_MAXK];
+    long v = -1 - code, first, seq;
+    int i, j, count, last, hlen;
+    struct fec_so *fec;
+    uint32_t crc;
 
-        // check if we complete the batch
-        if (du_in_batch >= batch_size) 
+    j = v % FEC_MAXM;
+    v /= FEC_MAXM;
+    last = v & 1;
+    count = (v >> 1) % 256;
+    first = (v >> 1) / 256;
+    for (i = 0; i < count; i++)
+    {
+        seq = first + i;
+        data[i] = (uint8_t *)buf + seq * datalen;
+        lens[i] = (lsize - seq * datalen < datalen) ? lsize - seq * datalen : datalen;
+    }
+    hlen = use_csum ? WIREHEADLEN + CSUMLEN : WIREHEADLEN;
+    fec = (struct fec_so *)((char *)head + hlen);
+    fec->index = j;
+    fec->count = count;
+    fec->pad = 0;
+    fec_encode((uint8_t *)(fec + 1), data, lens, count, j, datalen);
+    head->version = WIRE_VERSION;
+    head->flags = PKT_FEC | (flags & PKT_RETX) | (last ? flags & PKT_EOB : 0) | (use_csum ? PKT_CSUM : 0);
+    head->len = FECHEADLEN + datalen;
+    head->session = session_id;
+    head->offset = (uint64_t)first * datalen;
+    if (use_csum)
+    {
+        crc = crc32c(crc32c(0, head, WIREHEADLEN), fec, head->len);
+        memcpy((char *)head + WIREHEADLEN, &crc, CSUMLEN);
+    }
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = addr;
+    msg->msg_namelen = addrlen;
+    msg->msg_iov = iov;
+    iov[0].iov_base = head;
+    iov[0].iov_len = hlen + head->len;
+    msg->msg_iovlen = 1;
+    parity_sent++;
+    stats.packets++;
+    stats.bytes += head->len;
+    stats.retransmits += (flags & PKT_RETX) != 0;
+    trace(flags & PKT_RETX ? TR_RETX : TR_SEND, session_id, -1 - first, head->len);
+}
+
+// Split the batch into blocks of fec_k DUs (the last one may be shorter) and put each
+// block's fec_m parity packets right after it; without -f the list is the batch
+int fec_list(long *batch, int count, long *list)
+{
+    int i, j, n = 0, block;
+
+    for (i = 0; i < count; i += block)
+    {
+        block = (fec_m > 0 && count - i > fec_k) ? fec_k : count - i;
+        for (j = 0; j < block; j++)
+        {
+            list[n++] = batch[i + j];
+        }
+        for (j = 0; j < fec_m; j++)
         {
-            // wait for ack
-            from_len = addrlen;
-            n = recvfrom(sockfd, &ack, sizeof(ack), 0, addr, &from_len);
+            list[n++] = PARITY_SEQ(batch[i], block, i + block == count, j);
+        }
+    }
+    return n;
+}
+
+// Send the count packets listed in seqs, all with flags; PKT_EOB only goes on the last DU
+// (and on the parity of the batch's last block)
+int send_seqs(int sockfd, char *buf, long lsize, long *seqs, int count, int flags, struct sockaddr *addr,
+              int addrlen)
+{
+    static char *pool = NULL;           // packet buffers, header + checksum + datalen bytes each
+    static struct iovec iovs[MMSG_MAX][2];
+    static struct mmsghdr msgs[MMSG_MAX];
+    int i, n, chunk, sent, slot, slots, last, lastdu;
+
+    if (pool == NULL)
+    {
+        pool = (char *) malloc(MMSG_POOL);
+        if (pool == NULL)
+        {
+            exit(2);
+        }
+    }
+    // With -z only the header is built in the pool; the payload stays in the mapping
+    slot = WIREHEADLEN + CSUMLEN + (zero_copy ? 0 : datalen);
+    if (fec_m > 0)
+    {
+        slot = WIREHEADLEN + CSUMLEN + FECHEADLEN + datalen;   // parity is built in the pool
+    }
+    slot = (slot + 7) & ~7;             // keep every header's 64-bit offset aligned
+    slots = (MMSG_POOL / slot < MMSG_MAX) ? MMSG_POOL / slot : MMSG_MAX;
+    for (lastdu = count - 1; lastdu > 0 && seqs[lastdu] < 0; lastdu--)
+        ;
 
-            if (n == -1) 
+    if (!use_mmsg && !use_uring)
+    {
+        for (i = 0; i < count; i++)
+        {
+            last = (i == lastdu) ? flags : flags & ~PKT_EOB;
+            if (seqs[i] < 0)
+            {
+                build_parity(&msgs[0].msg_hdr, iovs[0], (struct data_so *)pool, buf, lsize, seqs[i], flags, addr,
+                             addrlen);
+            }
+            else
+            {
+                build_msg(&msgs[0].msg_hdr, iovs[0], (struct data_so *)pool, buf, lsize, seqs[i], last, addr,
+                          addrlen);
+            }
+            if (sendmsg(sockfd, &msgs[0].msg_hdr, 0) == -1)
             {
-                printf("Receive ACK error!\n");
-                free(buf);
                 return -1;
             }
-            if (ack.num == 1 && ack.len == 0) 
+            stats.send_calls++;
+            stats.send_pkts++;
+            timing_sent(&timing);
+        }
+        return count;
+    }
+
+    // One sendmmsg (or, with -u, one io_uring_enter) per pool of packets instead of one
+    // sendmsg per packet
+    for (i = 0; i < count; i += chunk)
+    {
+        chunk = (count - i < slots) ? count - i : slots;
+        for (n = 0; n < chunk; n++)
+        {
+            last = (i + n == lastdu) ? flags : flags & ~PKT_EOB;
+            if (seqs[i + n] < 0)
+            {
+                build_parity(&msgs[n].msg_hdr, iovs[n], (struct data_so *)(pool + n * slot), buf, lsize,
+                             seqs[i + n], flags, addr, addrlen);
+            }
+            else
             {
-                printf("ACK received for batch of %d DU(s)\n\n", batch_size);
-            } 
-            else 
+                build_msg(&msgs[n].msg_hdr, iovs[n], (struct data_so *)(pool + n * slot), buf, lsize, seqs[i + n],
+                          last, addr, addrlen);
+            }
+        }
+        if (use_uring)
+        {
+            if (send_uring(msgs, chunk) == -1)
+            {
+                return -1;
+            }
+            timing_sent(&timing);
+            continue;
+        }
+        for (sent = 0; sent < chunk; sent += n)
+        {
+            n = sendmmsg(sockfd, msgs + sent, chunk - sent, 0);
+            if (n == -1)
             {
-                printf("Error in acknowledgment\n");
-                free(buf);
                 return -1;
             }
+            stats.send_calls++;
+            stats.send_pkts += n;
+            timing_sent(&timing);
+        }
+    }
+    return count;
+}
 
-            // Move to next batch
-            du_in_batch = 0;
-            batch_size++;
-            // Cycle between batch sizes of 1 to 2 to 3 back to 1
-            if (batch_size > 3)
+// Queue one sendmsg request per message on the fixed-file socket, submit them all with a
+// single io_uring_enter and wait until every one has completed, since the pool they point
+// into is refilled next
+int send_uring(struct mmsghdr *msgs, int count)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int i, done = 0, failed = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        sqe = uring_sqe(&ring);
+        if (sqe == NULL)
+        {
+            return -1;
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (unsigned long)&msgs[i].msg_hdr;
+        sqe->len = 1;
+        sqe->user_data = i;
+    }
+    while (done < count)
+    {
+        if (uring_submit(&ring, count - done, -1) == -1)
+        {
+            return -1;
+        }
+        stats.send_calls++;
+        while ((cqe = uring_cqe(&ring)) != NULL)
+        {
+            failed |= cqe->res < 0;
+            uring_cqe_seen(&ring);
+            done++;
+        }
+    }
+    stats.send_pkts += count;
+    return failed ? -1 : count;
+}
+
+int recv_acks(int sockfd, struct ack_so *acks, int max)
+{
+    static struct iovec iovs[MMSG_MAX];
+    static struct mmsghdr msgs[MMSG_MAX];
+    int i, n, got;
+
+    if (!use_mmsg)
+    {
+        n = recvfrom(sockfd, &acks[0], sizeof(acks[0]), 0, NULL, NULL);
+        if (n == -1)
+        {
+            return -1;
+        }
+        stats.recv_calls++;
+        stats.recv_pkts++;
+        return ack_ok(&acks[0], n) ? 1 : 0;
+    }
+
+    // Drain every ACK already queued on the socket with one recvmmsg
+    if (max > MMSG_MAX)
+    {
+        max = MMSG_MAX;
+    }
+    for (i = 0; i < max; i++)
+    {
+        iovs[i].iov_base = &acks[i];
+        iovs[i].iov_len = sizeof(acks[i]);
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(sockfd, msgs, max, MSG_DONTWAIT, NULL);
+    if (n == -1)
+    {
+        return (errno == EAGAIN) ? 0 : -1;
+    }
+    stats.recv_calls++;
+    stats.recv_pkts += n;
+
+    // Compact away anything that is not a whole acknowledgment
+    for (i = 0, got = 0; i < n; i++)
+    {
+        if (ack_ok(&acks[i], msgs[i].msg_len))
+        {
+            acks[got++] = acks[i];
+        }
+    }
+    return got;
+}
+
+// ACKs are variable length: the fixed head plus as many bitmap words as the receiver needed
+bool ack_ok(struct ack_so *ack, int n)
+{
+    return n >= ACKHEADLEN && ack->num == 1 && ack->len <= SACK_WORDS && n == ACKHEADLEN + 8 * ack->len;
+}
+
+int negotiate(int sockfd, struct sockaddr *addr, int addrlen, char **buf, long *lsize, int mode)
+{
+    struct hello_so hello, reply;
+    struct rto_so rto;
+    struct pollfd pfd;
+    long sent, wait;
+    int n;
+    char *wire = *buf;
+    bool *skip;
+
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = HELLO_MAGIC;
+    hello.version = WIRE_VERSION;
+    hello.mode = mode;
+    hello.datalen = datalen;
+    hello.session = session_id;
+    hello.fec_k = fec_k;
+    hello.fec_m = fec_m;
+    hello.size = hello.raw_size = *lsize;
+    if (streams > 1 || resume)
+    {
+        hello.resume = resume;
+        hello.base = range_base;
+        hello.total = file_total;
+        hello.group = group;
+        hello.stream = stream;
+        hello.streams = streams;
+    }
+    if (hash_file)
+    {
+        // One pass over the file before the first DU; with SSE4.2 it runs at memory speed
+        hello.hash = 1;
+        hello.file_crc = crc32c(0, *buf, *lsize);
+    }
+    // A file in which no block looks compressible goes as it is
+    if (use_zip)
+    {
+        skip = malloc((*lsize + ZBLOCK - 1) / ZBLOCK + 1);
+        if (skip == NULL)
+        {
+            exit(2);
+        }
+        if (zip_survey(*buf, *lsize, &zip, skip) > 0)
+        {
+            wire = zip_image(*buf, *lsize, &zip, skip);
+            if (wire == NULL)
             {
-                batch_size = 1;
+                exit(2);
             }
+            hello.zip = 1;
+            hello.size = zip.wire;
         }
+        free(skip);
     }
+    rto_init(&rto);
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
 
-    gettimeofday(&recvt, NULL);
-    *len = ci;
+    // Resend the hello with backoff until the server echoes it
+    while (1)
+    {
+        if (sendto(sockfd, &hello, sizeof(hello), 0, addr, addrlen) == -1)
+        {
+            break;
+        }
+        sent = now_us();
+        do
+        {
+            wait = sent + rto.rto - now_us();
+            n = poll(&pfd, 1, wait > 0 ? (wait + 999) / 1000 : 0);
+            if (n <= 0 || recvfrom(sockfd, &reply, sizeof(reply), 0, NULL, NULL) != sizeof(reply) ||
+                reply.magic != HELLO_MAGIC || reply.session != hello.session)
+            {
+                continue;
+            }
+            if (reply.version != WIRE_VERSION)
+            {
+                printf("The server speaks wire format version %u, not %u\n", reply.version, WIRE_VERSION);
+                n = -1;
+                break;
+            }
+            if (reply.size == hello.size && reply.datalen >= MINDATALEN && reply.datalen <= hello.datalen)
+            {
+                datalen = reply.datalen;
+                if (fec_m > 0 && reply.fec_m == 0)
+                {
+                    printf("The server does not decode FEC, sending without it\n");
+                }
+                fec_k = reply.fec_k;
+                fec_m = reply.fec_m;
+                if (hash_file && reply.hash == 0)
+                {
+                    printf("The server does not check the file hash\n");
+                }
+                if (hello.zip)
+                {
+                    if (reply.zip == 0)
+                    {
+                        printf("The server does not decompress\n");
+                        n = -1;
+                        break;
+                    }
+                    release_file(*buf, *lsize);
+                    *buf = image = wire;
+                    *lsize = zip.wire;
+                }
+                return 0;
+            }
+        } while (n > 0);
+        if (n == -1 || rto_backoff(&rto) == -1)
+        {
+            break;
+        }
+    }
+    if (wire != *buf)
+    {
+        free(wire);
+    }
+    return -1;
+}
 
-    tv_sub(&recvt, &sendt);
-    time_inv = (recvt.tv_sec) * 1000.0 + (recvt.tv_usec) / 1000.0;
+char *load_file(FILE *fp, long lsize)
+{
+    char *buf;
 
-    free(buf);
-    return time_inv;
+    if (zero_copy)
+    {
+        // Map the file instead of reading it: nothing is copied up front and pages are
+        // faulted in (with sequential read-ahead) as the sender reaches them
+        if (lsize == 0)
+        {
+            return NULL;
+        }
+        buf = mmap(NULL, lsize, PROT_READ, MAP_PRIVATE, fileno(fp), range_base);  // a multiple of ZBLOCK
+        if (buf == MAP_FAILED)
+        {
+            printf("mmap error!\n");
+            exit(2);
+        }
+        madvise(buf, lsize, MADV_SEQUENTIAL);
+    }
+    else
+    {
+        // Allocate memory to contain the whole file and read it in
+        buf = (char *) malloc(lsize + 1);
+        if (buf == NULL)
+        {
+            exit(2);
+        }
+        fread(buf, 1, lsize, fp);
+        buf[lsize] = '\0';
+    }
+    return buf;
+}
+
+void release_file(char *buf, long lsize)
+{
+    anon_kb = rss_anon_kb();
+    if (buf == image)
+    {
+        free(image);
+        image = NULL;
+    }
+    else if (!zero_copy)
+    {
+        free(buf);
+    }
+    else if (buf != NULL)
+    {
+        munmap(buf, lsize);
+    }
 }
 
-void tv_sub(struct  timeval *out, struct timeval *in)
+long rss_anon_kb(void)
 {
-	if ((out->tv_usec -= in->tv_usec) <0)
-	{
-		--out ->tv_sec;
-		out ->tv_usec += 1000000;
-	}
-	out->tv_sec -= in->tv_sec;
-}
\ No newline at end of file
+    char line[128];
+    long kb = 0;
+    FILE *status = fopen("/proc/self/status", "r");
+
+    if (status == NULL)
+    {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (sscanf(line, "RssAnon: %ld", &kb) == 1)
+        {
+            break;
+        }
+    }
+    fclose(status);
+    return kb;
+}
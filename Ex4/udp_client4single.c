@@ -1,14 +1,16 @@
 #include "headsock.h"
+#include "timing.h"
 
 // Function declarations
-float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len);  // Transmission function
-void tv_sub(struct  timeval *out, struct timeval *in); // Calculate the time interval between out and in
+double str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len);  // Transmission function
+
+struct timing_so timing;  // time spent in each phase of the transfer
 
 int main(int argc, char **argv)
 {
     // Socket and network variables
     int sockfd;                    // Socket file descriptor
-    float ti, rt;                       // ti = transmission time (ms), rt = data rate
+    double ti, rt;                      // ti = transmission time (ms), rt = data rate
     long len;                           // Total bytes transmitted
     struct sockaddr_in ser_addr;        // Server address structure
     char **pptr;                        // Pointer for iterating through aliases
@@ -16,6 +18,8 @@ int main(int argc, char **argv)
     struct in_addr **addrs;             // Array of IP addresses
     FILE *fp;                           // File pointer for the file to send
 
+    timing_init(&timing);
+
     // Check command line arguments: program requires hostname as parameter
     if (argc != 2) 
     {
@@ -74,20 +78,26 @@ int main(int argc, char **argv)
 
     // Perform the transmission and receiving using varying-batch-size protocol
     ti = str_cli(fp, sockfd, (struct sockaddr *)&ser_addr, sizeof(struct sockaddr_in), &len);
+
+    // Clean up resources
+    close(sockfd);   // Close socket
+    fclose(fp);      // Close file
+    timing_phase(&timing, -1);
+    if (ti < 0)
+    {
+        exit(1);
+    }
     
     // Calculate the average transmission rate (bytes per millisecond = Kbytes/s)
-    rt = (len/(float)ti);
+    rt = len / ti;
     
     // Display transmission statistics
-    printf("Time(ms) : %.3f, Data sent(byte): %ld\nData rate: %f (Kbytes/s)\n", ti, (long)len, rt);
-    
-    // Clean up resources
-    close(sockfd);   // Close socket
-    fclose(fp);      // Close file
+    printf("Time(ms) : %.3f, Data sent(byte): %ld\nData rate: %f (Kbytes/s)\n", ti, len, rt);
+    timing_print(&timing);
     exit(0);
 }
 
-float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len) 
+double str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *len) 
 {
 	// Buffer and file handling variables
 	char *buf;                          // Pointer to buffer that will hold entire file
@@ -103,8 +113,7 @@ float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *le
     int du_in_batch = 0;                // Counter: how many DUs sent in current batch
 	
 	// Timing variables
-	float time_inv = 0.0;               // Will store transmission time in milliseconds
-	struct timeval sendt, recvt;        // Timestamps for start and end of transmission
+	double time_inv;                    // Will store transmission time in milliseconds
 	
     socklen_t from_len;
 	ci = 0;  // Initialize current index to start of file
@@ -115,10 +124,11 @@ float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *le
 	rewind(fp);                         // Move file pointer back to beginning
 	
 	// Display file and packet information
-	printf("The file length is %d bytes\n", (int)lsize);
+	printf("The file length is %ld bytes\n", lsize);
 	printf("the packet length is %d bytes\n",DATALEN);
 
     // Allocate memory to contain the whole file
+    timing_phase(&timing, PH_LOAD);
 	buf = (char *) malloc(lsize + 1);
 	if (buf == NULL) 
     {
@@ -130,7 +140,7 @@ float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *le
     buf[lsize] = '\0';  // Null-terminate the buffer
     
     // Start timing the transmission
-    gettimeofday(&sendt, NULL);
+    timing_phase(&timing, PH_FIRST);
     
     // Main transmission loop
     while (ci < lsize) {
@@ -157,6 +167,7 @@ float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *le
             free(buf);
             return -1;
         }
+        timing_sent(&timing);
 
         ci += slen;
         du_in_batch++; // increment DU count in batch
@@ -165,6 +176,7 @@ float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *le
         if (du_in_batch >= batch_size) 
         {
             // wait for ack
+            timing_phase(&timing, PH_ACK_WAIT);
             from_len = addrlen;
             n = recvfrom(sockfd, &ack, sizeof(ack), 0, addr, &from_len);
 
@@ -186,26 +198,15 @@ float str_cli(FILE *fp, int sockfd, struct sockaddr *addr, int addrlen, long *le
             }
 
             // Move to next batch
+            timing_phase(&timing, PH_STEADY);
             du_in_batch = 0;
         }
     }
 
-    gettimeofday(&recvt, NULL);
+    timing_phase(&timing, PH_TEARDOWN);
     *len = ci;
-
-    tv_sub(&recvt, &sendt);
-    time_inv = (recvt.tv_sec) * 1000.0 + (recvt.tv_usec) / 1000.0;
+    time_inv = timing_transfer_ms(&timing);
 
     free(buf);
     return time_inv;
 }
-
-void tv_sub(struct  timeval *out, struct timeval *in)
-{
-	if ((out->tv_usec -= in->tv_usec) <0)
-	{
-		--out ->tv_sec;
-		out ->tv_usec += 1000000;
-	}
-	out->tv_sec -= in->tv_sec;
-}
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include "headsock.h"
+#include <signal.h>
+
+// A lossy link between udp_client4 and udp_ser4 on one machine, without netem: clients send
+// to PROXY_PORT, every client gets its own socket towards the server, and each datagram, in
+// either direction, goes through the same impairments before it is passed on.
+
+#define MAXFLOWS 1024  // clients the proxy relays for at the same time
+#define MAXDGRAM 65536  // largest datagram relayed
+
+struct link_so			//impairments of one direction, and what they did
+{
+double loss;				// -l: average share of datagrams lost
+double burst;				// -b: average length of a loss burst (1 = independent losses)
+bool bad;					// Gilbert-Elliott state: in a loss burst
+long delay;					// -d: one-way delay (us)
+long jitter;				// -j: delay varies uniformly by up to this much either way (us)
+double reorder;				// -r: share of datagrams that skip the queue and arrive out of order
+double dup;					// -D: share of datagrams delivered twice
+double rate;				// -B: bottleneck bandwidth (bytes/us, 0 = unlimited)
+long queue;					// -q: bytes the bottleneck queues before it drops
+long link_free;				// when the bottleneck has sent everything queued (us)
+long last_due;				// delivery time of the last in-order datagram (us)
+long relayed, lost, dropped, duplicated, reordered;
+};
+
+struct pkt_so			//a datagram waiting for its delivery time
+{
+long due;					// when it is sent on (us)
+unsigned long order;		// arrival order, to keep equal due times in sequence
+int fd;						// socket it leaves from
+struct sockaddr_in to;		// where to, for the client side; unused on a flow's connected socket
+int len;
+char data[];
+};
+
+struct flow_so			//one client and the socket that stands for it at the server
+{
+struct sockaddr_in addr;
+int fd;						// -1 = free
+long last_seen;				// ms, flows idle for IDLE_MS are closed
+};
+
+struct link_so up, down;  // client to server, server to client
+struct flow_so flows[MAXFLOWS];
+struct pkt_so **heap = NULL;  // packets in flight, earliest due first
+int heap_len = 0, heap_cap = 0;
+unsigned long arrivals = 0;
+int listen_port = PROXY_PORT;  // -L: where clients send to
+struct sockaddr_in server;  // -S host:port, udp_ser4 on this machine by default
+int ready_fd = -1;  // -R: write a byte here once the socket is bound, then close it
+volatile sig_atomic_t stop = 0;
+
+int open_flow(int epfd, struct sockaddr_in *addr);
+void relay(int epfd, int from, struct link_so *link, int to_fd, struct sockaddr_in *to);
+void impair(struct link_so *link, char *data, int len, int fd, struct sockaddr_in *to);
+void schedule(long due, int fd, struct sockaddr_in *to, char *data, int len);
+void deliver(long now);
+void expire_flows(int epfd);
+double uniform(void);
+void print_link(const char *name, struct link_so *link);
+void on_signal(int sig);
+long now_us(void);
+
+int main(int argc, char *argv[])
+{
+    int opt, listenfd, epfd, n, i;
+    int bufsize = SOCKBUF;
+    long now, wait, last_expiry = 0;
+    unsigned seed = getpid();
+    double rate_mbit = 0;
+    char host[256];
+    struct hostent *sh;
+    struct sockaddr_in my_addr;
+    struct epoll_event ev, events[64];
+    struct timespec ts;
+
+    memset(&up, 0, sizeof(up));
+    up.burst = 1;
+    up.queue = SOCKBUF;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(MYUDP_PORT);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    while ((opt = getopt(argc, argv, "l:b:d:j:r:D:B:q:s:L:S:R:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                up.loss = atof(optarg);
+                break;
+            case 'b':
+                up.burst = atof(optarg);
+                break;
+            case 'd':
+                up.delay = atof(optarg) * 1000;
+                break;
+            case 'j':
+                up.jitter = atof(optarg) * 1000;
+                break;
+            case 'r':
+                up.reorder = atof(optarg);
+                break;
+            case 'D':
+                up.dup = atof(optarg);
+                break;
+            case 'B':
+                rate_mbit = atof(optarg);
+                break;
+            case 'q':
+                up.queue = atol(optarg);
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            case 'L':
+                listen_port = atoi(optarg);
+                break;
+            case 'R':
+                ready_fd = atoi(optarg);
+                break;
+            case 'S':
+                if (sscanf(optarg, "%255[^:]:%hu", host, &server.sin_port) != 2 || (sh = gethostbyname(host)) == NULL)
+                {
+                    printf("Server must be host:port\n");
+                    exit(1);
+                }
+                memcpy(&server.sin_addr, sh->h_addr_list[0], sizeof(struct in_addr));
+                server.sin_port = htons(server.sin_port);
+                break;
+            default:
+                printf("Usage: %s [-l loss] [-b burst] [-d delay ms] [-j jitter ms] [-r reorder] [-D duplicate] "
+                       "[-B Mbit/s] [-q queue bytes] [-s seed] [-L listen port] [-S server host:port] [-R ready fd]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (up.loss < 0 || up.loss >= 1 || up.burst < 1 || up.jitter > up.delay)
+    {
+        printf("Loss must be in [0, 1), burst at least 1 and jitter no larger than the delay\n");
+        exit(1);
+    }
+    up.rate = rate_mbit / 8;   // Mbit/s = bits/us
+    down = up;
+    srandom(seed);
+
+    listenfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    my_addr.sin_family = AF_INET;
+    my_addr.sin_port = htons(listen_port);
+    my_addr.sin_addr.s_addr = INADDR_ANY;
+    bzero(&(my_addr.sin_zero), 8);
+    setsockopt(listenfd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(listenfd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    if (listenfd == -1 || bind(listenfd, (struct sockaddr *)&my_addr, sizeof(my_addr)) == -1)
+    {
+        printf("error in binding\n");
+        exit(1);
+    }
+    epfd = epoll_create1(0);
+    ev.events = EPOLLIN;
+    ev.data.u32 = MAXFLOWS;   // the listening socket; flows are 0..MAXFLOWS-1
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+    for (i = 0; i < MAXFLOWS; i++)
+    {
+        flows[i].fd = -1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    printf("relaying port %d to %s:%d\n", listen_port, inet_ntoa(server.sin_addr), ntohs(server.sin_port));
+    fflush(stdout);
+    if (ready_fd != -1)
+    {
+        write(ready_fd, "R", 1);
+        close(ready_fd);
+    }
+    while (!stop)
+    {
+        // Sleep until a datagram arrives or the next one in flight is due
+        now = now_us();
+        wait = heap_len > 0 ? heap[0]->due - now : 1000000;
+        if (wait < 0)
+        {
+            wait = 0;
+        }
+        ts.tv_sec = wait / 1000000;
+        ts.tv_nsec = wait % 1000000 * 1000;
+        n = epoll_pwait2(epfd, events, 64, &ts, NULL);
+        if (n == -1 && errno != EINTR)
+        {
+            printf("error in epoll\n");
+            exit(1);
+        }
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.u32 == MAXFLOWS)
+            {
+                relay(epfd, listenfd, &up, -1, NULL);
+            }
+            else
+            {
+                flows[events[i].data.u32].last_seen = now_us() / 1000;
+                relay(epfd, flows[events[i].data.u32].fd, &down, listenfd, &flows[events[i].data.u32].addr);
+            }
+        }
+        deliver(now_us());
+        if (now_us() / 1000 - last_expiry >= 1000)
+        {
+            expire_flows(epfd);
+            last_expiry = now_us() / 1000;
+        }
+    }
+    print_link("client->server", &up);
+    print_link("server->client", &down);
+    exit(0);
+}
+
+// The flow of a client, opened on its first datagram: a socket connected to the server, so
+// the server sees one address per client and its replies can be told apart
+int open_flow(int epfd, struct sockaddr_in *addr)
+{
+    struct epoll_event ev;
+    int i, free_slot = -1;
+    int bufsize = SOCKBUF;
+
+    for (i = 0; i < MAXFLOWS; i++)
+    {
+        if (flows[i].fd != -1 && flows[i].addr.sin_port == addr->sin_port &&
+            flows[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr)
+        {
+            flows[i].last_seen = now_us() / 1000;
+            return i;
+        }
+        if (flows[i].fd == -1 && free_slot == -1)
+        {
+            free_slot = i;
+        }
+    }
+    if (free_slot == -1)
+    {
+        return -1;
+    }
+    flows[free_slot].fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (flows[free_slot].fd == -1)
+    {
+        return -1;
+    }
+    setsockopt(flows[free_slot].fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(flows[free_slot].fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    connect(flows[free_slot].fd, (struct sockaddr *)&server, sizeof(server));
+    flows[free_slot].addr = *addr;
+    flows[free_slot].last_seen = now_us() / 1000;
+    ev.events = EPOLLIN;
+    ev.data.u32 = free_slot;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, flows[free_slot].fd, &ev);
+    return free_slot;
+}
+
+// Drain socket from and hand every datagram to the link. From the clients (to_fd -1) the
+// datagram goes out on the sender's flow; from the server it goes to the flow's client.
+void relay(int epfd, int from, struct link_so *link, int to_fd, struct sockaddr_in *to)
+{
+    static char buf[MAXDGRAM];
+    struct sockaddr_in addr;
+    socklen_t len;
+    int n, f;
+
+    while (1)
+    {
+        len = sizeof(addr);
+        n = recvfrom(from, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &len);
+        if (n == -1)
+        {
+            return;   // drained, or an ICMP error from a server that is not there yet
+        }
+        if (to_fd == -1)
+        {
+            f = open_flow(epfd, &addr);
+            if (f != -1)
+            {
+                impair(link, buf, n, flows[f].fd, NULL);
+            }
+        }
+        else
+        {
+            impair(link, buf, n, to_fd, to);
+        }
+    }
+}
+
+// Decide the fate of one datagram: lost in a burst, dropped at a full bottleneck, or
+// delivered (maybe twice, maybe out of order) after its queueing and propagation delay
+void impair(struct link_so *link, char *data, int len, int fd, struct sockaddr_in *to)
+{
+    double enter_bad, leave_bad = 1.0 / link->burst;
+    long now = now_us(), start, due;
+
+    // Gilbert-Elliott: a burst starts with probability p and ends with 1/burst, which puts
+    // the long-run loss at p / (p + 1/burst)
+    enter_bad = link->loss * leave_bad / (1 - link->loss);
+    link->bad = link->bad ? uniform() >= leave_bad : uniform() < enter_bad;
+    if (link->bad)
+    {
+        link->lost++;
+        return;
+    }
+
+    // A bottleneck of rate bytes/us: the datagram waits for the ones ahead of it
+    start = now;
+    if (link->rate > 0)
+    {
+        start = link->link_free > now ? link->link_free : now;
+        if ((start - now) * link->rate > link->queue)
+        {
+            link->dropped++;
+            return;
+        }
+        link->link_free = start + (long)(len / link->rate);
+    }
+    due = start + link->delay + (link->jitter > 0 ? (long)((uniform() * 2 - 1) * link->jitter) : 0);
+    if (link->reorder > 0 && uniform() < link->reorder)
+    {
+        // Held back by one more delay (at least 1ms): the datagrams behind it overtake
+        due += link->delay > 1000 ? link->delay : 1000;
+        link->reordered++;
+    }
+    else
+    {
+        // Jitter varies the delay but does not reorder, like a queue would
+        if (due < link->last_due)
+        {
+            due = link->last_due;
+        }
+        link->last_due = due;
+    }
+    schedule(due, fd, to, data, len);
+    link->relayed++;
+    if (link->dup > 0 && uniform() < link->dup)
+    {
+        schedule(due, fd, to, data, len);
+        link->duplicated++;
+    }
+}
+
+// Put a copy of the datagram on the heap of packets in flight
+void schedule(long due, int fd, struct sockaddr_in *to, char *data, int len)
+{
+    struct pkt_so *p, *t;
+    int i;
+
+    p = (struct pkt_so *) malloc(sizeof(struct pkt_so) + len);
+    if (p == NULL)
+    {
+        return;
+    }
+    p->due = due;
+    p->order = arrivals++;
+    p->fd = fd;
+    if (to != NULL)
+    {
+        p->to = *to;
+    }
+    else
+    {
+        p->to.sin_family = AF_UNSPEC;
+    }
+    p->len = len;
+    memcpy(p->data, data, len);
+    if (heap_len == heap_cap)
+    {
+        heap_cap = heap_cap ? heap_cap * 2 : 1024;
+        heap = (struct pkt_so **) realloc(heap, heap_cap * sizeof(*heap));
+        if (heap == NULL)
+        {
+            exit(2);
+        }
+    }
+    for (i = heap_len++; i > 0; i = (i - 1) / 2)
+    {
+        t = heap[(i - 1) / 2];
+        if (t->due < p->due || (t->due == p->due && t->order < p->order))
+        {
+            break;
+        }
+        heap[i] = t;
+    }
+    heap[i] = p;
+}
+
+// Send on everything that is due
+void deliver(long now)
+{
+    struct pkt_so *p, *last;
+    int i, c;
+
+    while (heap_len > 0 && heap[0]->due <= now)
+    {
+        p = heap[0];
+        if (p->to.sin_family == AF_INET)
+        {
+            sendto(p->fd, p->data, p->len, 0, (struct sockaddr *)&p->to, sizeof(p->to));
+        }
+        else
+        {
+            send(p->fd, p->data, p->len, 0);   // a full socket buffer is one more loss
+        }
+        free(p);
+        if (--heap_len == 0)
+        {
+            break;
+        }
+        last = heap[heap_len];
+        for (i = 0; (c = 2 * i + 1) < heap_len; i = c)
+        {
+            if (c + 1 < heap_len && (heap[c + 1]->due < heap[c]->due ||
+                                     (heap[c + 1]->due == heap[c]->due && heap[c + 1]->order < heap[c]->order)))
+            {
+                c++;
+            }
+            if (last->due < heap[c]->due || (last->due == heap[c]->due && last->order < heap[c]->order))
+            {
+                break;
+            }
+            heap[i] = heap[c];
+        }
+        heap[i] = last;
+    }
+}
+
+// Close the flows of clients that have been silent for IDLE_MS
+void expire_flows(int epfd)
+{
+    long now = now_us() / 1000;
+    int i;
+
+    for (i = 0; i < MAXFLOWS; i++)
+    {
+        if (flows[i].fd != -1 && now - flows[i].last_seen >= IDLE_MS)
+        {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, flows[i].fd, NULL);
+            close(flows[i].fd);
+            flows[i].fd = -1;
+        }
+    }
+}
+
+double uniform(void)
+{
+    return random() / ((double)RAND_MAX + 1);
+}
+
+void print_link(const char *name, struct link_so *link)
+{
+    printf("%s: %ld relayed, %ld lost, %ld dropped at the bottleneck, %ld duplicated, %ld reordered\n",
+           name, link->relayed, link->lost, link->dropped, link->duplicated, link->reordered);
+}
+
+void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
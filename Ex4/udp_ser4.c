@@ -1,133 +1,1867 @@
 #include "headsock.h"
-bool done = false;
+#include "crc32c.h"
+#include "uring.h"
+#include "fec.h"
+#include "stats.h"
+#include "zip.h"
 
-void str_ser4(int sockfd);
+// Receive buffer for one datagram of a session with payload size d: header, checksum, payload,
+// but never less than a hello, rounded up so the 64-bit offset of the next datagram in a
+// recvmmsg pool stays aligned
+#define RX_BYTES(d) (WIREHEADLEN + CSUMLEN + (d) > (int)sizeof(struct hello_so) ? WIREHEADLEN + CSUMLEN + (d) : (int)sizeof(struct hello_so))
+#define RX_SLOT(d) ((RX_BYTES(d) + 7) & ~7)
+#define MAP_MAGIC 0x50414d34  // "4MAP": first word of a checkpoint map file
+#define MAPHEADLEN 16  // MAP_MAGIC, RESUME_BLOCK and the file size, then one byte per block
+
+bool use_mmsg = false;  // -m: drain the socket with recvmmsg and send queued ACKs with sendmmsg
+int max_datalen = MAXDATALEN;  // -p: largest payload size a client may negotiate
+int port = MYUDP_PORT;  // -P: port to receive on
+int ready_fd = -1;  // -r: write a byte here once the socket is bound, then close it (for bench4)
+bool print_stats = false;  // -s: add the counters to the statistics printed after each transfer
+char *trace_name = NULL;  // -T: record packet events and dump them here (with -w, one file per worker)
+volatile sig_atomic_t stopping = 0;  // SIGTERM/SIGINT: leave the event loop and clean up
+int max_transfers = 0;  // -n: exit once this many transfers are complete (0 = serve forever)
+int workers = -1;  // -w: SO_REUSEPORT worker processes (0 = one per CPU, -1 = no workers, serve here)
+int worker_id = -1;  // which worker this process is
+pid_t worker_pids[MAXWORKERS];  // -w: the workers, for the parent to pass a SIGTERM on to
+volatile sig_atomic_t started_workers = 0;  // -w: how many of worker_pids are set (0 in the workers)
+int *shared_completed = NULL;  // transfers completed by all workers together
+int rx_slot = RX_SLOT(MINDATALEN);  // receive buffer per datagram, grown to the largest live session's size
+long bad_csum = 0;  // packets dropped because their checksum did not match
+long fec_recovered = 0;  // DUs rebuilt from parity instead of being resent
+long bad_hash = 0;  // files whose CRC32C did not match the one in their hello
+long bad_blocks = 0;  // compressed blocks that did not decode
+long zip_raw = 0, zip_wire = 0;  // file bytes decoded from compressed transfers, and image bytes they came in
+long checkpoints = 0;  // -r: times stored data was made durable and recorded in a map
+bool use_uring = false;  // -u: receives, file writes and ACKs all go through one io_uring
+long uring_enters = 0, uring_writes = 0;  // io_uring_enter calls made and file writes they carried
+
+union ctrl_so			//any datagram the server sends back
+{
+struct ack_so ack;
+struct hello_so hello;
+};
+
+struct fec_block_so		//a block of the current batch whose DUs and parity are being collected
+{
+long first;					// sequence number of its first DU, -1 = entry unused
+int count;					// DUs in the block, known once a parity packet arrived (0 = not yet)
+uint64_t have;				// DU i of the block is in buf
+unsigned have_parity;		// parity packet j is in buf
+char *buf;					// fec_k DUs, then fec_m parity packets, datalen bytes each
+};
+
+struct session_so		//one transfer, found by client address + session id
+{
+struct sockaddr_in addr;	// where the client sends from, and where its ACKs go
+uint32_t id;				// hello_so.session
+int mode;					// MODE_BATCH or MODE_SR
+int datalen;				// negotiated payload size
+long size;					// file size
+long received;				// bytes stored so far
+int fd;						// output file, -1 once the transfer is complete
+int file_index;				// -u: fd's slot in the fixed-file table, -1 = not registered
+int writes;					// -u: writes queued on the ring and not completed yet
+int closing_fd;				// -u: complete, but fd still had writes in flight; closed after the last
+long unflushed;				// bytes written since writeback was last started
+bool hash;					// the client sent peer_crc, the CRC32C of the whole file
+uint32_t peer_crc;
+uint32_t file_crc;			// CRC32C of the file's first hashed bytes, as received
+long hashed;
+bool zip;					// the packets carry the zblock_so image of the file; size is the image's
+long raw_size;				// file size
+long base;					// where byte 0 of the file goes in the output: -S and -r send ranges of one file
+long total;					// size of the whole output file
+long stored;				// bytes from base on stored without a gap
+int map_fd;					// -r: the file's checkpoint map, -1 = not resumable
+uint32_t group;				// -r: names the output file and its map
+long checkpointed;			// -r: bytes from base on that are durable and marked in the map
+char *zbuf;					// zip: image bytes from zbase on, stored until their block is whole
+long zbase, zhigh, zcap;	// image offset of zbuf[0], end of the highest bytes stored, bytes allocated
+long zdone;					// image offset of the first block not decoded yet
+long zraw;					// file offset the next decoded block goes to
+long last_seen;				// last datagram (ms), for dropping abandoned sessions
+long linger_until;			// complete: keep re-acking until then (ms)
+long retransmitted;			// packets flagged PKT_RETX, duplicates or not
+int fec_k, fec_m;			// batch mode FEC: fec_m parity packets per fec_k DUs (0 = none)
+struct fec_block_so fec[FEC_PENDING];
+// batch mode
+long batch_start;			// sequence number of the first DU of the current batch
+int expecting;				// DUs in the current batch, learned from its PKT_EOB DU (0 = not yet)
+int count;					// DUs of the current batch stored
+// selective repeat: the sender never runs more than MAXWINDOW packets ahead of the oldest
+// one we are missing, so a ring of MAXWINDOW bits past cum is all the state it needs
+long cum;					// every packet below cum is stored
+long npkts;					// packets in the transfer
+int unacked;				// packets received since the last ACK (0 = none due)
+bool due;					// on the due list: its ACK goes out before the server sleeps
+struct session_so *due_next;
+unsigned char bits[MAXWINDOW / 8];  // batch: DU batch_start + i stored; SR: packet num % MAXWINDOW stored
+struct session_so *next;	// hash bucket chain
+};
+
+static struct session_so *sessions[SESSION_BUCKETS];
+static int live_sessions = 0;
+static int completed = 0;   // transfers received in full
+static struct session_so *due_list = NULL;  // sessions whose selective-repeat ACK is pending
+
+// ACKs waiting for the next sendmmsg (used with -m only)
+static union ctrl_so ack_queue[MMSG_MAX];
+static int ack_queue_len[MMSG_MAX];
+static struct sockaddr_in ack_queue_addr[MMSG_MAX];
+static int ack_queued = 0;
+
+// -u: every receive buffer slot is a piece of one registered buffer. A slot is held by its
+// posted receive, and then by the file write of the payload it received; it is posted
+// again once nothing holds it.
+enum {UR_RECV, UR_WRITE, UR_ACK};	// what a completion's user_data belongs to (upper 32 bits)
+struct ur_slot_so
+{
+struct msghdr msg;
+struct iovec iov;
+struct sockaddr_in addr;
+int refs;					// the receive, plus a write of its payload
+int len;					// bytes the write was asked for
+struct session_so *session;	// whose file the write goes to
+};
+struct ur_ack_so			//one ACK on its way out
+{
+union ctrl_so ack;
+struct sockaddr_in addr;
+struct iovec iov;
+struct msghdr msg;
+};
+static struct uring_so ring;
+static char *ur_pool = NULL;
+static int ur_slot_size;
+static struct ur_slot_so ur_slots[URING_RECVS];
+static struct ur_ack_so ur_acks[URING_ACKS];
+static int ur_free_acks[URING_ACKS], ur_nfree_acks = 0;
+static int ur_free_files[URING_FILES], ur_nfree_files = 0;
+
+int open_socket(bool reuseport);
+void start_workers(int count);
+void serve(int sockfd);
+void signal_ready(void);
+void on_signal(int sig);
+void serve_uring(int sockfd);
+void ur_post_recv(int i);
+void ur_release(int i);
+void ur_completion(int sockfd, uint64_t data, int res);
+int transfers_done(void);
+void handle_datagram(int sockfd, char *dgram, int n, struct sockaddr_in *addr);
+struct session_so *find_session(struct sockaddr_in *addr, uint32_t id);
+struct session_so *new_session(struct hello_so *hello, struct sockaddr_in *addr);
+void free_session(struct session_so *s);
+void expire_sessions(void);
+void str_ser4(int sockfd, struct session_so *s, struct data_so *head, char *data);
+void str_ser4_sr(int sockfd, struct session_so *s, struct data_so *head, char *data);
+void complete_session(struct session_so *s);
+void fec_data(struct session_so *s, long num, char *data, int data_len);
+void fec_parity(struct session_so *s, struct data_so *head, char *data);
+struct fec_block_so *fec_block(struct session_so *s, long first);
+void fec_try(struct session_so *s, struct fec_block_so *b);
+bool is_hello(char *dgram, int n);
+void send_batch_ack(int sockfd, struct session_so *s, long last);
+int open_output(uint32_t id, bool readable, bool shared);
+int open_map(uint32_t group, long total, bool create);
+void answer_query(int sockfd, struct hello_so *hello, struct sockaddr_in *addr);
+void checkpoint(struct session_so *s, int fd, long end);
+void checkpoint_sessions(void);
+void store_data(struct session_so *s, char *data, int data_len, long offset);
+void finish_output(int fd, long size);
+void close_output(struct session_so *s, int fd);
+void hash_to(struct session_so *s, int fd, long end);
+void stored_to(struct session_so *s, long end);
+void zip_store(struct session_so *s, char *data, int data_len, long offset);
+void unzip_to(struct session_so *s, long end);
+void zip_compact(struct session_so *s);
+int recv_pack(int sockfd, char **dgram, struct sockaddr_in *addr);
+void send_ack(int sockfd, void *ack, int size, struct sockaddr_in *addr);
+void ack_due(struct session_so *s);
+void flush_acks(int sockfd);
+void send_sr_ack(int sockfd, struct session_so *s);
+long now_ms(void);
+void print_syscalls(void);
 
 int main(int argc, char *argv[])
+{
+    int opt, sockfd;
+    struct rlimit files;
+
+    while ((opt = getopt(argc, argv, "mp:n:w:uP:r:sT:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                use_mmsg = true;
+                break;
+            case 'p':
+                max_datalen = atoi(optarg);
+                if (max_datalen < MINDATALEN || max_datalen > MAXDATALEN)
+                {
+                    printf("Payload size must be between %d and %d\n", MINDATALEN, MAXDATALEN);
+                    exit(1);
+                }
+                break;
+            case 'n':
+                max_transfers = atoi(optarg);
+                break;
+            case 'u':
+                use_uring = true;
+                break;
+            case 'P':
+                port = atoi(optarg);
+                break;
+            case 'r':
+                ready_fd = atoi(optarg);
+                break;
+            case 's':
+                print_stats = true;
+                break;
+            case 'T':
+                trace_name = optarg;
+                break;
+            case 'w':
+                workers = atoi(optarg);
+                if (workers == 0)
+                {
+                    workers = sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                if (workers < 1 || workers > MAXWORKERS)
+                {
+                    printf("Workers must be between 1 and %d\n", MAXWORKERS);
+                    exit(1);
+                }
+                break;
+            default:
+                printf("Usage: %s [-m | -u] [-p max payload] [-n transfers] [-w workers] [-P port] [-r ready fd] [-s] [-T trace.bin]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    // Every concurrent upload holds its output file open
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0)
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+	fec_init();
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	printf("start receiving\n");
+	if (workers > 0)
+	{
+		start_workers(workers);
+	}
+	else
+	{
+		sockfd = open_socket(false);
+		signal_ready();
+		serve(sockfd);
+	}
+	exit(0);
+}
+
+int open_socket(bool reuseport)
 {
     int sockfd;
+    int bufsize = SOCKBUF;
+    int on = 1;
     struct sockaddr_in my_addr;
 
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd == -1) 
+    sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sockfd == -1)
     {
         printf("error in socket");
         exit(1);
     }
 
     my_addr.sin_family = AF_INET;
-    my_addr.sin_port = htons(MYUDP_PORT);
+    my_addr.sin_port = htons(port);
     my_addr.sin_addr.s_addr = INADDR_ANY; // contains 32 bit address. INADDR_ANY means it accepts any server IPs. For a specific IP address, use inet_addr("192.168.1.100")
     bzero(&(my_addr.sin_zero), 8);
-	if (bind(sockfd, (struct sockaddr *) &my_addr, sizeof(struct sockaddr)) == -1) 
-    {          
+    // Room for a whole window of large datagrams; the kernel caps this at net.core.rmem_max
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    if (reuseport)
+    {
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
+	if (bind(sockfd, (struct sockaddr *) &my_addr, sizeof(struct sockaddr)) == -1)
+    {
 		printf("error in binding");
 		exit(1);
 	}
-	printf("start receiving\n");
-	while (!done) 
+    return sockfd;
+}
+
+// One process per worker, each with its own SO_REUSEPORT socket on MYUDP_PORT. The kernel
+// picks the socket for a datagram by hashing its addresses and ports, so every packet of a
+// session reaches the same worker and session state is never shared or locked. All sockets
+// are bound before any worker starts, so the group, and with it the hash, never changes.
+void start_workers(int count)
+{
+    int socks[MAXWORKERS];
+    pid_t *pids = worker_pids;
+    cpu_set_t cpus;
+    int i, j;
+
+    shared_completed = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared_completed == MAP_FAILED)
     {
-		str_ser4(sockfd); 
-	}
-	close(sockfd);
-	exit(0);
+        printf("error in mmap\n");
+        exit(1);
+    }
+    *shared_completed = 0;
+    for (i = 0; i < count; i++)
+    {
+        socks[i] = open_socket(true);
+    }
+    signal_ready();
+    fflush(stdout);
+    for (i = 0; i < count; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == -1)
+        {
+            printf("error in fork\n");
+            exit(1);
+        }
+        if (pids[i] == 0)
+        {
+            started_workers = 0;
+            for (j = 0; j < count; j++)
+            {
+                if (j != i)
+                {
+                    close(socks[j]);
+                }
+            }
+            // Keep each worker on its own core, next to its socket's data
+            CPU_ZERO(&cpus);
+            CPU_SET(i % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+            sched_setaffinity(0, sizeof(cpus), &cpus);
+            worker_id = i;
+            serve(socks[i]);
+            exit(0);
+        }
+        started_workers = i + 1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        close(socks[i]);
+    }
+    for (i = 0; i < count; i++)
+    {
+        waitpid(pids[i], NULL, 0);
+    }
 }
 
-void str_ser4(int sockfd)
+// Event loop: sleep in epoll until datagrams arrive or a session timer is due, drain the
+// socket handing every datagram to its session, then send the ACKs that drain earned
+void serve(int sockfd)
 {
-    char buf[BUFSIZE];
-	FILE *fp;
-	char recvs[DATALEN];
+    int epfd;
+    int n;
+    long last_expiry = now_ms();
+    struct epoll_event ev;
     struct sockaddr_in addr;
-	struct ack_so ack;
-    struct pack_so received_pack;
-	int n = 0;
-    int len = sizeof(struct sockaddr_in);
-	long lseek = 0;
-	bool end = false;
-    int expecting = 1;
-    int count = 0;
-    long total_file_size = 0;  // Track expected total file size
+    char *dgram;
+    char trace_file[PATH_MAX];
+
+    if (trace_name != NULL)
+    {
+        // Each worker traces its own sessions into a file of its own
+        snprintf(trace_file, sizeof(trace_file), worker_id >= 0 ? "%s.%d" : "%s", trace_name, worker_id);
+        if (trace_open(strdup(trace_file)) == -1)
+        {
+            printf("error in trace buffer\n");
+            exit(1);
+        }
+    }
+    if (use_uring)
+    {
+        serve_uring(sockfd);
+        return;
+    }
+    epfd = epoll_create1(0);
+    ev.events = EPOLLIN;
+    ev.data.fd = sockfd;
+    if (epfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) == -1)
+    {
+        printf("error in epoll\n");
+        exit(1);
+    }
+
+    while (!stopping && (max_transfers == 0 || transfers_done() < max_transfers || live_sessions > 0))
+    {
+        // With sessions alive, wake up in time for their linger and idle deadlines; with -n,
+        // also to notice that other workers finished the count
+        n = epoll_wait(epfd, &ev, 1, live_sessions > 0 || max_transfers > 0 ? LINGER_MS / 4 : -1);
+        if (n == -1 && errno != EINTR)
+        {
+            printf("error in epoll\n");
+            exit(1);
+        }
+        while ((n = recv_pack(sockfd, &dgram, &addr)) != -1)
+        {
+            handle_datagram(sockfd, dgram, n, &addr);
+        }
+        if (errno != EAGAIN)
+        {
+            printf("error when receiving\n");
+            exit(1);
+        }
+        flush_acks(sockfd);
+        if (now_ms() - last_expiry >= LINGER_MS / 4)
+        {
+            expire_sessions();
+            last_expiry = now_ms();
+        }
+    }
+    checkpoint_sessions();
+    close(epfd);
+    close(sockfd);
+}
+
+// -u: the same loop on an io_uring. URING_RECVS recvmsg requests stay posted, each into its
+// own slot of a registered buffer. A payload is written to its file with WRITE_FIXED straight
+// from the slot it arrived in, and that receive is posted again once the write completes.
+// ACKs are sendmsg requests. One io_uring_enter per pass submits all of it and sleeps until
+// something completes, so this one thread keeps the socket and the disk busy at once.
+void serve_uring(int sockfd)
+{
+    struct io_uring_cqe *cqe;
+    uint64_t data;
+    int files[URING_FILES];
+    long last_expiry = now_ms();
+    int i, res;
+
+    // A request on a non-blocking socket fails with EAGAIN instead of waiting for data
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK);
+    ur_slot_size = RX_SLOT(max_datalen);
+    ur_pool = mmap(NULL, (size_t)URING_RECVS * ur_slot_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ur_pool == MAP_FAILED || uring_init(&ring, URING_DEPTH) == -1 ||
+        uring_register_buffer(&ring, ur_pool, (size_t)URING_RECVS * ur_slot_size) == -1)
+    {
+        printf("error in io_uring setup: %s\n", strerror(errno));
+        exit(1);
+    }
+    // Slot 0 is the socket; the others are handed to output files as sessions start
+    files[0] = sockfd;
+    for (i = 1; i < URING_FILES; i++)
+    {
+        files[i] = -1;
+        ur_free_files[ur_nfree_files++] = URING_FILES - i;
+    }
+    if (uring_register_files(&ring, files, URING_FILES) == -1)
+    {
+        printf("error in io_uring file registration: %s\n", strerror(errno));
+        exit(1);
+    }
+    for (i = 0; i < URING_ACKS; i++)
+    {
+        ur_free_acks[ur_nfree_acks++] = i;
+    }
+    for (i = 0; i < URING_RECVS; i++)
+    {
+        ur_post_recv(i);
+    }
 
-    while (!end)
+    while (!stopping && (max_transfers == 0 || transfers_done() < max_transfers || live_sessions > 0))
     {
-        while (count < expecting)
+        if (uring_submit(&ring, 1, live_sessions > 0 || max_transfers > 0 ? LINGER_MS / 4 * 1000L : -1) == -1)
+        {
+            printf("error in io_uring_enter: %s\n", strerror(errno));
+            exit(1);
+        }
+        uring_enters++;
+        while ((cqe = uring_cqe(&ring)) != NULL)
         {
-            n = recvfrom(sockfd, &received_pack, sizeof(received_pack), 0, (struct sockaddr *) &addr, &len); // recive packet
-            if (n == -1)
+            data = cqe->user_data;
+            res = cqe->res;
+            uring_cqe_seen(&ring);
+            ur_completion(sockfd, data, res);
+        }
+        flush_acks(sockfd);
+        if (now_ms() - last_expiry >= LINGER_MS / 4)
+        {
+            expire_sessions();
+            last_expiry = now_ms();
+        }
+    }
+    uring_submit(&ring, 0, -1);   // the last ACKs
+    checkpoint_sessions();
+    uring_close(&ring);
+    close(sockfd);
+}
+
+void ur_post_recv(int i)
+{
+    struct ur_slot_so *slot = &ur_slots[i];
+    struct io_uring_sqe *sqe;
+
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->iov.iov_base = ur_pool + (size_t)i * ur_slot_size;
+    slot->iov.iov_len = ur_slot_size;
+    slot->msg.msg_name = &slot->addr;
+    slot->msg.msg_namelen = sizeof(slot->addr);
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+    slot->refs = 1;
+    sqe = uring_sqe(&ring);
+    if (sqe == NULL)
+    {
+        printf("io_uring submission queue full\n");
+        exit(1);
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = 0;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (unsigned long)&slot->msg;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)UR_RECV << 32 | i;
+}
+
+void ur_release(int i)
+{
+    if (--ur_slots[i].refs == 0)
+    {
+        ur_post_recv(i);
+    }
+}
+
+void ur_completion(int sockfd, uint64_t data, int res)
+{
+    int i = (int)(data & 0xffffffff);
+    struct session_so *s;
+
+    switch (data >> 32)
+    {
+        case UR_RECV:
+            if (res < 0)
             {
-                printf("error when receiving\n");
-                exit(1);
-            }
-            printf("receiving data!\n");
-            
-            // Get total file size from first packet
-            if (lseek == 0 && count == 0) {
-                total_file_size = received_pack.len;
-                printf("Expected file size: %ld bytes\n", total_file_size);
-                
-                // Check if file fits in buffer
-                if (total_file_size > BUFSIZE) {
-                    printf("Error: File size (%ld bytes) exceeds buffer size (%d bytes)\n", 
-                           total_file_size, BUFSIZE);
-                    printf("Please increase BUFSIZE in headsock.h\n");
+                if (res != -EINTR && res != -EAGAIN && res != -ENOBUFS)
+                {
+                    printf("error when receiving: %s\n", strerror(-res));
                     exit(1);
                 }
             }
-            
-            int remaining = n - HEADLEN;
-            int data_len = remaining;
-            
-            // Check if this is the last packet based on total bytes received
-            if (lseek + data_len >= total_file_size) {
-                end = true;
-                count = 999;
-                // Adjust data_len to not exceed file size
-                data_len = total_file_size - lseek;
-            }
-            
-            // Prevent buffer overflow
-            if (lseek + data_len > BUFSIZE) {
-                printf("Buffer overflow prevented! lseek=%ld, data_len=%d, BUFSIZE=%d\n",
-                       lseek, data_len, BUFSIZE);
+            else
+            {
+                stats.recv_pkts++;
+                handle_datagram(sockfd, ur_pool + (size_t)i * ur_slot_size, res, &ur_slots[i].addr);
+            }
+            ur_release(i);
+            break;
+        case UR_WRITE:
+            s = ur_slots[i].session;
+            if (res != ur_slots[i].len)
+            {
+                printf("write error!\n");
                 exit(1);
             }
-            
-            memcpy((buf + lseek), received_pack.data, data_len);
-            lseek += data_len;
-            count += 1;
-        }
-        switch (expecting) {
-            case 1:
-                expecting = 2;
-                break;
-            case 2:
-                expecting = 3;
-                break;
-            case 3:
-                expecting = 1;
-                break;
-            default:
-                printf("sumtin wron");
+            if (--s->writes == 0 && s->closing_fd != -1)
+            {
+                close_output(s, s->closing_fd);
+                s->closing_fd = -1;
+            }
+            else if (s->writes == 0 && s->map_fd != -1 && s->fd != -1 && s->stored - s->checkpointed >= CHECKPOINT_BYTES)
+            {
+                checkpoint(s, s->fd, s->stored);  // only now is everything up to stored written
+            }
+            ur_release(i);
+            break;
+        case UR_ACK:
+            // A full socket buffer just loses this ACK; the client retransmits
+            if (res < 0 && res != -EAGAIN)
+            {
+                printf("send ack error!\n");
                 exit(1);
+            }
+            ur_free_acks[ur_nfree_acks++] = i;
+            break;
+    }
+}
+
+// Tell whoever started us that datagrams sent from now on will be received
+void signal_ready(void)
+{
+    if (ready_fd != -1)
+    {
+        write(ready_fd, "R", 1);
+        close(ready_fd);
+        ready_fd = -1;
+    }
+}
+
+// Stop cleanly, so that with -u the ring is torn down and the port is free when we exit.
+// The -w parent only waits for its workers: it passes the signal on and goes on reaping them.
+void on_signal(int sig)
+{
+    int i;
+
+    stopping = 1;
+    for (i = 0; i < started_workers; i++)
+    {
+        kill(worker_pids[i], sig);
+    }
+}
+
+int transfers_done(void)
+{
+    return shared_completed != NULL ? __atomic_load_n(shared_completed, __ATOMIC_RELAXED) : completed;
+}
+
+void handle_datagram(int sockfd, char *dgram, int n, struct sockaddr_in *addr)
+{
+    struct session_so *s;
+    struct hello_so *hello;
+    struct data_so *head;
+    uint32_t crc;
+    int hlen;
+
+    if (is_hello(dgram, n))
+    {
+        hello = (struct hello_so *)dgram;
+        if (hello->version != WIRE_VERSION)
+        {
+            hello->version = WIRE_VERSION;   // tell the client what we speak instead
+            send_ack(sockfd, hello, sizeof(*hello), addr);
+            return;
         }
-        count = 0;
-        ack.num = 1;
-        ack.len = 0;
-        if (sendto(sockfd, &ack, sizeof(ack), 0, (struct sockaddr *)&addr, len) == -1)
+        if (hello->mode == MODE_QUERY)
         {
-            printf("send ack error!\n");
-            exit(1);
+            answer_query(sockfd, hello, addr);
+            return;
         }
+        s = find_session(addr, hello->session);
+        if (s == NULL)
+        {
+            s = new_session(hello, addr);
+            if (s == NULL)
+            {
+                return;
+            }
+        }
+        // Echo the hello with the agreed payload size; a repeated hello means our first
+        // reply was lost
+        hello->datalen = s->datalen;
+        hello->fec_k = s->fec_k;
+        hello->fec_m = s->fec_m;
+        hello->hash = s->hash;
+        hello->zip = s->zip;
+        s->last_seen = now_ms();
+        send_ack(sockfd, hello, sizeof(*hello), addr);
+        return;
     }
-    fp = fopen("bigfilereceive.bin", "wb");
-    if (fp == NULL)
+
+    // A v2 data packet: header, checksum if flagged, then exactly len payload bytes
+    head = (struct data_so *)dgram;
+    if (n < WIREHEADLEN || head->version != WIRE_VERSION)
     {
-        printf("File not existing\n");
-        exit(1);
+        return;
+    }
+    hlen = (head->flags & PKT_CSUM) ? WIREHEADLEN + CSUMLEN : WIREHEADLEN;
+    if (n != hlen + head->len)
+    {
+        return;
+    }
+    s = find_session(addr, head->session);
+    if (s == NULL)
+    {
+        return; // stray packet of a session that is gone
+    }
+    if (head->flags & PKT_FEC)
+    {
+        // Parity names its block by the first DU's offset and always carries a full payload
+        if (s->fec_m == 0 || head->len != FECHEADLEN + s->datalen || head->offset % s->datalen != 0 ||
+            head->offset >= (uint64_t)s->size)
+        {
+            return;
+        }
+    }
+    else if (head->offset % s->datalen != 0 || head->offset + head->len > (uint64_t)s->size ||
+             (head->len < s->datalen && head->offset + head->len != (uint64_t)s->size))
+    {
+        stats.misfits++;
+        trace(TR_DROP, head->session, head->offset / s->datalen, head->len);
+        return;
     }
-    fwrite(buf, 1, lseek, fp);
-    fclose(fp);
-    printf("a file has been successfully received!\nthe total data received is %d bytes\n", (int)lseek);
-    done = true;  // Set done AFTER file is written
-}
\ No newline at end of file
+    if (head->flags & PKT_CSUM)
+    {
+        memcpy(&crc, dgram + WIREHEADLEN, CSUMLEN);
+        if (crc32c(crc32c(0, head, WIREHEADLEN), dgram + hlen, head->len) != crc)
+        {
+            bad_csum++;
+            trace(TR_DROP, head->session, head->offset / s->datalen, head->len);
+            return; // damaged: the sender's timer will send it again
+        }
+    }
+    s->last_seen = now_ms();
+    stats.packets++;
+    stats.bytes += head->len;
+    if (head->flags & PKT_RETX)
+    {
+        s->retransmitted++;
+        stats.retransmits++;
+    }
+    trace(head->flags & PKT_RETX ? TR_RETX : TR_RECV, s->id,
+          head->flags & PKT_FEC ? -1 - (long)(head->offset / s->datalen) : (long)(head->offset / s->datalen), head->len);
+    if (s->mode == MODE_SR)
+    {
+        str_ser4_sr(sockfd, s, head, dgram + hlen);
+    }
+    else
+    {
+        str_ser4(sockfd, s, head, dgram + hlen);
+    }
+}
+
+static unsigned int session_hash(struct sockaddr_in *addr, uint32_t id)
+{
+    uint32_t h = addr->sin_addr.s_addr * 2654435761u ^ addr->sin_port * 40503u ^ id * 2246822519u;
+
+    return (h ^ (h >> 15)) % SESSION_BUCKETS;
+}
+
+struct session_so *find_session(struct sockaddr_in *addr, uint32_t id)
+{
+    struct session_so *s;
+
+    for (s = sessions[session_hash(addr, id)]; s != NULL; s = s->next)
+    {
+        if (s->id == id && s->addr.sin_port == addr->sin_port && s->addr.sin_addr.s_addr == addr->sin_addr.s_addr)
+        {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// A hello from an unknown address/session pair starts a transfer, with the payload size
+// clamped to what this server accepts
+struct session_so *new_session(struct hello_so *hello, struct sockaddr_in *addr)
+{
+    struct session_so *s;
+    unsigned int h;
+    int i;
+
+    s = (struct session_so *) calloc(1, sizeof(struct session_so));
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    s->addr = *addr;
+    s->id = hello->session;
+    s->mode = hello->mode;
+    s->datalen = hello->datalen;
+    if (s->datalen > max_datalen)
+    {
+        s->datalen = max_datalen;
+    }
+    if (s->datalen < MINDATALEN)
+    {
+        s->datalen = MINDATALEN;
+    }
+    s->size = hello->size;
+    s->hash = hello->hash == 1;
+    s->zip = hello->zip == 1;
+    s->raw_size = s->zip ? (long)hello->raw_size : s->size;
+    s->peer_crc = hello->file_crc;
+    s->base = hello->streams > 1 || hello->resume ? (long)hello->base : 0;
+    s->total = hello->streams > 1 || hello->resume ? (long)hello->total : s->raw_size;
+    s->map_fd = -1;
+    s->checkpointed = s->raw_size > 0 ? 0 : -1;   // -r: an empty range's one checkpoint is at 0
+    if (s->base < 0 || s->raw_size < 0 || s->base + s->raw_size > s->total)
+    {
+        printf("session %08x: a range of %ld bytes at %ld does not fit a %ld byte file\n", s->id, s->raw_size, s->base,
+               s->total);
+        free(s);
+        return NULL;
+    }
+    // FEC is for batch mode; a parity packet needs room for fec_so next to a full payload
+    if (s->mode == MODE_BATCH && hello->fec_k >= 1 && hello->fec_k <= FEC_MAXK && hello->fec_m >= 1 &&
+        hello->fec_m <= FEC_MAXM)
+    {
+        s->fec_k = hello->fec_k;
+        s->fec_m = hello->fec_m;
+        if (s->datalen > max_datalen - FECHEADLEN)
+        {
+            s->datalen = max_datalen - FECHEADLEN;
+        }
+        for (i = 0; i < FEC_PENDING; i++)
+        {
+            s->fec[i].first = -1;
+            s->fec[i].buf = (char *) malloc((size_t)(s->fec_k + s->fec_m) * s->datalen);
+            if (s->fec[i].buf == NULL)
+            {
+                s->fec_k = s->fec_m = 0;   // no memory for it: do without
+            }
+        }
+    }
+    s->npkts = (s->size + s->datalen - 1) / s->datalen;
+    s->group = hello->group;
+    if (hello->resume && (s->map_fd = open_map(s->group, s->total, true)) == -1)
+    {
+        printf("session %08x: cannot open the checkpoint map, not resumable\n", s->id);
+    }
+    s->fd = open_output(hello->streams > 1 || hello->resume ? hello->group : s->id, s->hash,
+                        hello->streams > 1 || hello->resume);
+    if (s->fd == -1)
+    {
+        printf("cannot open the output file of session %08x\n", s->id);
+        if (s->map_fd != -1)
+        {
+            close(s->map_fd);
+        }
+        for (i = 0; i < FEC_PENDING; i++)
+        {
+            free(s->fec[i].buf);
+        }
+        free(s);
+        return NULL;
+    }
+    s->file_index = -1;
+    s->closing_fd = -1;
+    // With the table full, writes simply name the plain descriptor
+    if (use_uring && ur_nfree_files > 0 && uring_set_file(&ring, ur_free_files[ur_nfree_files - 1], s->fd) >= 0)
+    {
+        s->file_index = ur_free_files[--ur_nfree_files];
+    }
+    h = session_hash(addr, s->id);
+    s->next = sessions[h];
+    sessions[h] = s;
+    live_sessions++;
+    if (RX_SLOT(s->datalen + (s->fec_m > 0 ? FECHEADLEN : 0)) > rx_slot)
+    {
+        rx_slot = RX_SLOT(s->datalen + (s->fec_m > 0 ? FECHEADLEN : 0));
+    }
+    printf("session %08x from %s:%d: expected file size %ld bytes, %d byte packets\n",
+           s->id, inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), s->size, s->datalen);
+    if (s->fec_m > 0)
+    {
+        printf("session %08x: FEC %d+%d\n", s->id, s->fec_k, s->fec_m);
+    }
+    if (s->zip)
+    {
+        printf("session %08x: compressed, %ld file bytes in %ld\n", s->id, s->raw_size, s->size);
+    }
+    if (hello->streams > 1 || hello->resume)
+    {
+        printf("session %08x: %s %d of %d, bytes %ld to %ld of bigfilereceive-%08x.bin\n", s->id,
+               hello->resume ? "resumable range, stream" : "stream", hello->stream, hello->streams, s->base,
+               s->base + s->raw_size, hello->group);
+    }
+    if (s->size == 0)
+    {
+        complete_session(s);   // an empty file needs no data packets
+    }
+    return s;
+}
+
+void free_session(struct session_so *s)
+{
+    struct session_so **p;
+    int i;
+
+    for (p = &sessions[session_hash(&s->addr, s->id)]; *p != s; p = &(*p)->next)
+        ;
+    *p = s->next;
+    for (p = &due_list; *p != NULL; p = &(*p)->due_next)
+    {
+        if (*p == s)
+        {
+            *p = s->due_next;
+            break;
+        }
+    }
+    if (s->fd != -1)
+    {
+        // Cut off: what arrived without a gap need not be sent again
+        if (s->map_fd != -1 && s->writes == 0)
+        {
+            checkpoint(s, s->fd, s->stored);
+        }
+        close_output(s, -1);
+        close(s->fd);
+    }
+    if (s->map_fd != -1)
+    {
+        close(s->map_fd);
+    }
+    for (i = 0; i < FEC_PENDING; i++)
+    {
+        free(s->fec[i].buf);
+    }
+    free(s->zbuf);
+    free(s);
+    // Nothing large is expected any more: let recvmmsg pack small datagrams densely again
+    if (--live_sessions == 0)
+    {
+        rx_slot = RX_SLOT(MINDATALEN);
+    }
+}
+
+// Forget complete sessions whose linger is over, and uploads whose client went silent
+void expire_sessions(void)
+{
+    struct session_so *s, *next;
+    long now = now_ms();
+    int i;
+
+    for (i = 0; i < SESSION_BUCKETS; i++)
+    {
+        for (s = sessions[i]; s != NULL; s = next)
+        {
+            next = s->next;
+            if (s->writes > 0)
+            {
+                continue;   // -u: the ring still writes from its buffers into this session's file
+            }
+            if (s->fd == -1 && now >= s->linger_until)
+            {
+                free_session(s);
+            }
+            else if (s->fd != -1 && now - s->last_seen >= IDLE_MS)
+            {
+                printf("session %08x timed out after %ld of %ld bytes\n", s->id, s->received, s->size);
+                free_session(s);
+            }
+        }
+    }
+}
+
+// Batch mode: the client sizes each batch from its congestion window, flags the last DU of
+// the batch with PKT_EOB and waits for one ACK per batch. With FEC a batch's DUs come in
+// blocks, each followed by its parity packets, and a block missing no more DUs than parity
+// packets arrived is rebuilt here instead of being resent.
+void str_ser4(int sockfd, struct session_so *s, struct data_so *head, char *data)
+{
+    long num = head->offset / s->datalen;
+    long slot;
+    int data_len = head->len;
+    long offset = head->offset;
+
+    if (head->flags & PKT_FEC)
+    {
+        if (s->fd != -1 && num >= s->batch_start && num - s->batch_start < MAXWINDOW)
+        {
+            fec_parity(s, head, data);
+            goto progress;
+        }
+        return;
+    }
+    if (s->fd == -1)
+    {
+        send_batch_ack(sockfd, s, num);  // complete, but a final ACK was lost
+        return;
+    }
+
+    // A DU from an earlier batch means the client timed out and resent it because
+    // our ACK was lost: answer the batch's last DU again, drop the rest
+    if (num < s->batch_start)
+    {
+        if (num == s->batch_start - 1)
+        {
+            send_batch_ack(sockfd, s, num);
+        }
+        return;
+    }
+    slot = num - s->batch_start;
+    if (slot >= MAXWINDOW || (s->expecting > 0 && slot >= s->expecting))
+    {
+        return; // not part of this batch
+    }
+    if (head->flags & PKT_EOB)
+    {
+        s->expecting = slot + 1;
+    }
+    if (s->bits[slot / 8] & (1 << (slot % 8)))
+    {
+        return; // duplicate within the batch
+    }
+
+    // DUs of a resent batch can overtake each other, so place by offset
+    store_data(s, data, data_len, offset);
+    s->bits[slot / 8] |= 1 << (slot % 8);
+    s->count++;
+    if (s->fec_m > 0)
+    {
+        fec_data(s, num, data, data_len);
+    }
+
+progress:
+    if (s->count == s->expecting || s->received >= s->size)
+    {
+        // ACK the batch, cumulatively up to its last DU so the client can tell it from a stale ACK
+        send_batch_ack(sockfd, s, s->batch_start + s->count - 1);
+        memset(s->bits, 0, sizeof(s->bits));
+        s->batch_start += s->count;
+        s->count = 0;
+        s->expecting = 0;
+        for (slot = 0; slot < FEC_PENDING; slot++)
+        {
+            s->fec[slot].first = -1;
+        }
+        stored_to(s, s->batch_start * s->datalen);
+    }
+    if (s->received >= s->size)
+    {
+        complete_session(s);
+    }
+}
+
+// Keep a copy of DU num for its block, in case other DUs of the block need rebuilding
+void fec_data(struct session_so *s, long num, char *data, int data_len)
+{
+    long first = s->batch_start + (num - s->batch_start) / s->fec_k * s->fec_k;
+    struct fec_block_so *b = fec_block(s, first);
+    char *dst = b->buf + (num - first) * s->datalen;
+
+    memcpy(dst, data, data_len);
+    memset(dst + data_len, 0, s->datalen - data_len);
+    b->have |= 1ULL << (num - first);
+    fec_try(s, b);
+}
+
+void fec_parity(struct session_so *s, struct data_so *head, char *data)
+{
+    struct fec_so *fec = (struct fec_so *)data;
+    long first = head->offset / s->datalen;
+    struct fec_block_so *b;
+
+    // Blocks start every fec_k DUs from the start of the batch and stay inside the file
+    if ((first - s->batch_start) % s->fec_k != 0 || fec->count < 1 || fec->count > s->fec_k ||
+        fec->index >= s->fec_m || (first + fec->count - 1) * s->datalen >= s->size)
+    {
+        return;
+    }
+    // The parity of the batch's last block knows where the batch ends, even if its last DU is lost
+    if ((head->flags & PKT_EOB) && first - s->batch_start + fec->count <= MAXWINDOW)
+    {
+        s->expecting = first - s->batch_start + fec->count;
+    }
+    b = fec_block(s, first);
+    b->count = fec->count;
+    memcpy(b->buf + (size_t)(s->fec_k + fec->index) * s->datalen, fec + 1, s->datalen);
+    b->have_parity |= 1u << fec->index;
+    fec_try(s, b);
+}
+
+// The entry collecting the block that starts at first; a new block takes a free entry, or
+// the one of the oldest block, whose losses are then left to the retransmission timer
+struct fec_block_so *fec_block(struct session_so *s, long first)
+{
+    struct fec_block_so *b = &s->fec[0];
+    int i;
+
+    for (i = 0; i < FEC_PENDING; i++)
+    {
+        if (s->fec[i].first == first)
+        {
+            return &s->fec[i];
+        }
+        if (s->fec[i].first < b->first)
+        {
+            b = &s->fec[i];
+        }
+    }
+    b->first = first;
+    b->count = 0;
+    b->have = 0;
+    b->have_parity = 0;
+    return b;
+}
+
+// Rebuild what the block is missing once enough parity is in, and store it like a received DU
+void fec_try(struct session_so *s, struct fec_block_so *b)
+{
+    uint8_t *data[FEC_MAXK], *parity[FEC_MAXM];
+    long num, slot;
+    int i, len;
+
+    if (b->count == 0)
+    {
+        return;
+    }
+    for (i = 0; i < b->count; i++)
+    {
+        data[i] = (uint8_t *)b->buf + (size_t)i * s->datalen;
+    }
+    for (i = 0; i < s->fec_m; i++)
+    {
+        parity[i] = (uint8_t *)b->buf + (size_t)(s->fec_k + i) * s->datalen;
+    }
+    if (b->have != (b->count == 64 ? ~0ULL : (1ULL << b->count) - 1) &&
+        fec_recover(data, b->have, parity, b->have_parity, b->count, s->datalen) == -1)
+    {
+        return;
+    }
+    for (i = 0; i < b->count; i++)
+    {
+        num = b->first + i;
+        slot = num - s->batch_start;
+        if (!(s->bits[slot / 8] & (1 << (slot % 8))))
+        {
+            len = (s->size - num * s->datalen < s->datalen) ? s->size - num * s->datalen : s->datalen;
+            store_data(s, (char *)data[i], len, num * s->datalen);
+            s->bits[slot / 8] |= 1 << (slot % 8);
+            s->count++;
+            fec_recovered++;
+            trace(TR_REBUILT, s->id, num, len);
+        }
+    }
+    b->first = -1;   // every DU of the block is stored
+}
+
+void str_ser4_sr(int sockfd, struct session_so *s, struct data_so *head, char *data)
+{
+    long num = head->offset / s->datalen;
+    int data_len = head->len;
+
+    if (s->fd != -1)
+    {
+        if (num >= s->cum + MAXWINDOW)
+        {
+            stats.beyond_window++;
+            trace(TR_DROP, s->id, num, data_len);
+            return;
+        }
+
+        // Packets may arrive out of order or twice; write each at the offset its number gives
+        if (num >= s->cum && !(s->bits[(num % MAXWINDOW) / 8] & (1 << (num % 8))))
+        {
+            store_data(s, data, data_len, head->offset);
+            s->bits[(num % MAXWINDOW) / 8] |= 1 << (num % 8);
+            while (s->bits[(s->cum % MAXWINDOW) / 8] & (1 << (s->cum % 8)))
+            {
+                s->bits[(s->cum % MAXWINDOW) / 8] &= ~(1 << (s->cum % 8));
+                s->cum++;
+            }
+            stored_to(s, s->cum * s->datalen);
+        }
+        if (s->received >= s->size)
+        {
+            complete_session(s);
+        }
+    }
+
+    // Duplicates count too: the sender resent them because an ACK went missing.
+    // Once complete every packet is answered with the final ACK.
+    if (++s->unacked >= ACK_EVERY || s->fd == -1)
+    {
+        send_sr_ack(sockfd, s);
+    }
+    else
+    {
+        ack_due(s);
+    }
+}
+
+// The whole file is on disk. Keep the session for LINGER_MS: the final ACKs may be lost,
+// and retransmissions must still be answered.
+void complete_session(struct session_so *s)
+{
+    if (s->writes > 0)
+    {
+        s->closing_fd = s->fd;
+    }
+    else
+    {
+        close_output(s, s->fd);
+    }
+    s->fd = -1;
+    s->linger_until = now_ms() + LINGER_MS;
+    completed++;
+    if (shared_completed != NULL)
+    {
+        __atomic_add_fetch(shared_completed, 1, __ATOMIC_RELAXED);
+    }
+    if (worker_id >= 0)
+    {
+        printf("worker %d: ", worker_id);
+    }
+    printf("session %08x: a file has been successfully received!\nthe total data received is %ld bytes, "
+           "%ld packets flagged as retransmissions\n", s->id, s->received, s->retransmitted);
+    print_syscalls();
+}
+
+// readable: the file is read back for its hash. shared: id names a file that the other
+// streams of a -S transfer write their ranges of too, so whichever comes first creates it and
+// none truncates it.
+int open_output(uint32_t id, bool readable, bool shared)
+{
+    char name[64];
+    int flags = shared ? NEWFILE & ~O_TRUNC : NEWFILE;
+
+    sprintf(name, "bigfilereceive-%08x.bin", id);
+    return open(name, readable ? (flags & ~O_WRONLY) | O_RDWR : flags, 0644);
+}
+
+// -r: the checkpoint map of bigfilereceive-<group>.bin is bigfilereceive-<group>.map, a header
+// and a byte per RESUME_BLOCK of the file that is 1 once the block is on disk for good. Every
+// session of the file, in any worker, writes only the bytes of its own blocks, so they need no
+// lock. create: make a new map if there is none for a file of this size; otherwise -1.
+int open_map(uint32_t group, long total, bool create)
+{
+    char name[64];
+    uint32_t head[4], want[4] = {MAP_MAGIC, RESUME_BLOCK, (uint32_t)total, (uint32_t)(total >> 32)};
+    long blocks = (total + RESUME_BLOCK - 1) / RESUME_BLOCK;
+    int fd;
+
+    sprintf(name, "bigfilereceive-%08x.map", group);
+    fd = open(name, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (pread(fd, head, MAPHEADLEN, 0) == MAPHEADLEN && memcmp(head, want, MAPHEADLEN) == 0)
+    {
+        return fd;
+    }
+    // A map of another file, or half written: nothing in it can be trusted
+    if (!create || ftruncate(fd, 0) == -1 || ftruncate(fd, MAPHEADLEN + blocks) == -1 ||
+        pwrite(fd, want, MAPHEADLEN, 0) != MAPHEADLEN || fdatasync(fd) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// -r: tell a client which blocks of a file are stored, 8192 of them per answer from the one the
+// query asks about. Without a map (or without the file it describes) that is none.
+void answer_query(int sockfd, struct hello_so *hello, struct sockaddr_in *addr)
+{
+    static unsigned char bytes[RESUME_MAPBYTES * 8];
+    struct resume_so reply;
+    struct stat st;
+    char name[64];
+    long blocks = ((long)hello->total + RESUME_BLOCK - 1) / RESUME_BLOCK, n = 0, i;
+    uint64_t first = hello->base / RESUME_BLOCK;
+    int fd = -1;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = RESUME_MAGIC;
+    reply.session = hello->session;
+    reply.block = RESUME_BLOCK;
+    reply.blocks = blocks;
+    reply.first = first < (uint64_t)blocks ? (long)first : blocks;
+    reply.count = blocks - reply.first < RESUME_MAPBYTES * 8 ? blocks - reply.first : RESUME_MAPBYTES * 8;
+    sprintf(name, "bigfilereceive-%08x.bin", hello->group);
+    if (stat(name, &st) == 0 && (fd = open_map(hello->group, hello->total, false)) != -1)
+    {
+        n = pread(fd, bytes, reply.count, MAPHEADLEN + reply.first);
+        close(fd);
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (bytes[i] == 1)
+        {
+            reply.map[i / 8] |= 1 << (i % 8);
+        }
+    }
+    sendto(sockfd, &reply, RESUMEHEADLEN + (reply.count + 7) / 8, 0, (struct sockaddr *)addr, sizeof(*addr));
+}
+
+// -r: the first end bytes of the session's range are stored. Make them durable, then mark the
+// blocks that lie wholly inside them (the file's last block may be short) and make that
+// durable too, so the map never claims data a crash could still lose. Once every block is
+// marked the file is complete and the map goes.
+void checkpoint(struct session_so *s, int fd, long end)
+{
+    static char ones[4096], map[4096];
+    long blocks = (s->total + RESUME_BLOCK - 1) / RESUME_BLOCK;
+    long first = (s->base + RESUME_BLOCK - 1) / RESUME_BLOCK;
+    long last = s->base + end == s->total ? blocks : (s->base + end) / RESUME_BLOCK;
+    long b, n;
+    char name[64];
+
+    if (end <= s->checkpointed)
+    {
+        return;
+    }
+    if (ones[0] == 0)
+    {
+        memset(ones, 1, sizeof(ones));
+    }
+    if (fdatasync(fd) == -1)
+    {
+        return;
+    }
+    for (b = first; b < last; b += n)
+    {
+        n = last - b < (long)sizeof(ones) ? last - b : (long)sizeof(ones);
+        if (pwrite(s->map_fd, ones, n, MAPHEADLEN + b) != n)
+        {
+            return;
+        }
+    }
+    fdatasync(s->map_fd);
+    s->checkpointed = end;
+    checkpoints++;
+    if (end < s->raw_size)
+    {
+        return;
+    }
+    for (b = 0; b < blocks; b += n)
+    {
+        n = pread(s->map_fd, map, blocks - b < (long)sizeof(map) ? blocks - b : (long)sizeof(map), MAPHEADLEN + b);
+        if (n <= 0 || memchr(map, 0, n) != NULL)
+        {
+            break;
+        }
+    }
+    if (b >= blocks)
+    {
+        sprintf(name, "bigfilereceive-%08x.map", s->group);
+        unlink(name);
+        printf("session %08x: bigfilereceive-%08x.bin is complete\n", s->id, s->group);
+    }
+}
+
+// Leaving with transfers under way (SIGTERM): record how far each got
+void checkpoint_sessions(void)
+{
+    struct session_so *s;
+    int i;
+
+    for (i = 0; i < SESSION_BUCKETS; i++)
+    {
+        for (s = sessions[i]; s != NULL; s = s->next)
+        {
+            if (s->map_fd != -1 && s->fd != -1 && s->writes == 0)
+            {
+                checkpoint(s, s->fd, s->stored);
+            }
+        }
+    }
+}
+
+// Write a payload straight to its place in the output file; nothing is buffered in
+// user space, so memory use does not grow with the file
+void store_data(struct session_so *s, char *data, int data_len, long offset)
+{
+    struct io_uring_sqe *sqe;
+    int i = ur_pool != NULL ? (data - ur_pool) / ur_slot_size : -1;
+
+    // Data arriving in order is hashed while it is still in cache
+    if (s->hash && !s->zip && offset == s->hashed)
+    {
+        s->file_crc = crc32c(s->file_crc, data, data_len);
+        s->hashed += data_len;
+    }
+    if (s->zip)
+    {
+        zip_store(s, data, data_len, offset);   // written once its block is whole and decoded
+    }
+    else if (use_uring && i >= 0 && i < URING_RECVS)
+    {
+        // Queue the write from the receive slot itself; the slot is not reused before it
+        // completes. Data from anywhere else (a DU rebuilt from parity) is written at once.
+        sqe = uring_sqe(&ring);
+        if (sqe == NULL)
+        {
+            printf("io_uring submission queue full\n");
+            exit(1);
+        }
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = s->file_index >= 0 ? s->file_index : s->fd;
+        sqe->flags = s->file_index >= 0 ? IOSQE_FIXED_FILE : 0;
+        sqe->addr = (unsigned long)data;
+        sqe->len = data_len;
+        sqe->off = s->base + offset;
+        sqe->buf_index = 0;
+        sqe->user_data = (uint64_t)UR_WRITE << 32 | i;
+        ur_slots[i].refs++;
+        ur_slots[i].len = data_len;
+        ur_slots[i].session = s;
+        s->writes++;
+        uring_writes++;
+    }
+    else if (pwrite(s->fd, data, data_len, s->base + offset) != data_len)
+    {
+        printf("write error!\n");
+        exit(1);
+    }
+    s->received += data_len;
+    // Start writeback of dirty pages now rather than in one burst at close, so the disk
+    // works while the network is still delivering
+    s->unflushed += data_len;
+    if (s->unflushed >= WRITEBACK_BYTES)
+    {
+        sync_file_range(s->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        s->unflushed = 0;
+    }
+}
+
+void finish_output(int fd, long size)
+{
+    // An empty file never sees a pwrite, so set the final length explicitly; a -S stream sets
+    // that of the whole file, which only ever grows it
+    ftruncate(fd, size);
+    close(fd);
+}
+
+// Give back fd's fixed-file slot, then finish the file unless fd is -1
+void close_output(struct session_so *s, int fd)
+{
+    if (s->file_index >= 0)
+    {
+        uring_set_file(&ring, s->file_index, -1);
+        ur_free_files[ur_nfree_files++] = s->file_index;
+        s->file_index = -1;
+    }
+    if (fd != -1)
+    {
+        if (s->hash)
+        {
+            hash_to(s, fd, s->raw_size);
+            if (s->file_crc == s->peer_crc)
+            {
+                printf("session %08x: file CRC32C %08x verified\n", s->id, s->file_crc);
+            }
+            else
+            {
+                printf("session %08x: file CRC32C %08x, but the client's is %08x: the file is damaged\n",
+                       s->id, s->file_crc, s->peer_crc);
+                bad_hash++;
+            }
+        }
+        if (s->map_fd != -1)
+        {
+            checkpoint(s, fd, s->raw_size);
+        }
+        finish_output(fd, s->total);
+    }
+}
+
+// Extend the file hash to the first end bytes. What arrived out of order was not hashed when
+// it was stored, so it is read back from the page cache here once the gap before it is filled.
+void hash_to(struct session_so *s, int fd, long end)
+{
+    static char buf[256 * 1024];
+    long n;
+
+    if (end > s->raw_size)
+    {
+        end = s->raw_size;
+    }
+    while (s->hash && s->hashed < end)
+    {
+        n = pread(fd, buf, end - s->hashed < (long)sizeof(buf) ? end - s->hashed : (long)sizeof(buf), s->base + s->hashed);
+        if (n <= 0)
+        {
+            printf("session %08x: cannot read back the file to hash it\n", s->id);
+            s->hash = false;
+            bad_hash++;
+            return;
+        }
+        s->file_crc = crc32c(s->file_crc, buf, n);
+        s->hashed += n;
+    }
+}
+
+// Everything below image offset end is stored: decode the blocks that are now whole, or
+// extend the file hash
+void stored_to(struct session_so *s, long end)
+{
+    if (s->zip)
+    {
+        unzip_to(s, end);
+    }
+    else if (!use_uring)
+    {
+        hash_to(s, s->fd, end);   // -u: the writes may not have landed yet; hashed at the end
+    }
+    s->stored = s->zip ? s->zraw : end < s->raw_size ? end : s->raw_size;
+    // -u: a checkpoint waits for a moment with no write in flight, or for the end
+    if (s->map_fd != -1 && s->stored - s->checkpointed >= CHECKPOINT_BYTES && s->writes == 0)
+    {
+        checkpoint(s, s->fd, s->stored);
+    }
+}
+
+// Keep a piece of the compressed image until its block can be decoded. Only the window the
+// sender may have in flight past the oldest missing byte is ever held.
+void zip_store(struct session_so *s, char *data, int data_len, long offset)
+{
+    long need, cap;
+    char *grown;
+
+    if (offset < s->zdone)
+    {
+        return;
+    }
+    if (offset + data_len - s->zbase > s->zcap)
+    {
+        zip_compact(s);
+    }
+    need = offset + data_len - s->zbase;
+    if (need > s->zcap)
+    {
+        for (cap = s->zcap ? s->zcap : 2 * (ZBLOCK + ZHEADLEN); cap < need; cap *= 2)
+            ;
+        grown = realloc(s->zbuf, cap);
+        if (grown == NULL)
+        {
+            printf("out of memory for compressed data\n");
+            exit(1);
+        }
+        s->zbuf = grown;
+        s->zcap = cap;
+    }
+    memcpy(s->zbuf + offset - s->zbase, data, data_len);
+    if (offset + data_len > s->zhigh)
+    {
+        s->zhigh = offset + data_len;
+    }
+}
+
+// Decode and write every block that lies wholly below image offset end. Blocks are decoded in
+// order, so the file hash is extended right here.
+void unzip_to(struct session_so *s, long end)
+{
+    static char out[ZBLOCK];
+    struct zblock_so head;
+    long at = s->zdone, raw;
+    char *block, *src;
+
+    while (at + ZHEADLEN <= end && s->zraw < s->raw_size)
+    {
+        memcpy(&head, s->zbuf + at - s->zbase, ZHEADLEN);
+        if (at + ZHEADLEN + head.len > end)
+        {
+            break;
+        }
+        raw = s->raw_size - s->zraw < ZBLOCK ? s->raw_size - s->zraw : ZBLOCK;
+        block = s->zbuf + at - s->zbase + ZHEADLEN;
+        src = head.method == ZIP_RAW ? block : out;
+        if (head.method == ZIP_DEFLATE ? zip_unpack(block, head.len, out, raw) == -1 :
+            head.method != ZIP_RAW || head.len != raw)
+        {
+            printf("session %08x: the block at %ld does not decode\n", s->id, s->zraw);
+            bad_blocks++;
+            memset(out, 0, raw);   // keep the file the right size, the hash will tell
+            src = out;
+        }
+        if (pwrite(s->fd, src, raw, s->base + s->zraw) != raw)
+        {
+            printf("write error!\n");
+            exit(1);
+        }
+        if (s->hash)
+        {
+            s->file_crc = crc32c(s->file_crc, src, raw);
+            s->hashed += raw;
+        }
+        zip_raw += raw;
+        zip_wire += ZHEADLEN + head.len;
+        s->zraw += raw;
+        at += ZHEADLEN + head.len;
+    }
+    s->zdone = at;
+    if (s->zdone - s->zbase >= s->zcap / 2)
+    {
+        zip_compact(s);
+    }
+}
+
+// Move what is held past the decoded blocks to the front of zbuf. Done only once half the
+// buffer is decoded, so each byte is moved about once.
+void zip_compact(struct session_so *s)
+{
+    if (s->zdone > s->zbase)
+    {
+        memmove(s->zbuf, s->zbuf + s->zdone - s->zbase, s->zhigh > s->zdone ? s->zhigh - s->zdone : 0);
+        s->zbase = s->zdone;
+    }
+}
+
+void send_batch_ack(int sockfd, struct session_so *s, long last)
+{
+    struct ack_so ack;
+
+    ack.num = 1;
+    ack.len = 0;
+    ack.tag = (uint8_t)last;
+    ack.pad = 0;
+    ack.cum = last + 1;
+    trace(TR_ACK_SENT, s->id, ack.cum, ACKHEADLEN);
+    send_ack(sockfd, &ack, ACKHEADLEN, &s->addr);
+}
+
+// One ACK for everything received since the last one: the cumulative point plus a bitmap
+// of the packets after it, trimmed to the last word that has a bit set
+void send_sr_ack(int sockfd, struct session_so *s)
+{
+    struct ack_so ack;
+    long i, seq;
+    int words = 0;
+
+    memset(&ack, 0, sizeof(ack));
+    ack.num = 1;
+    ack.cum = s->fd == -1 ? s->npkts : s->cum;
+    for (i = 0; i < SACK_WORDS * 64 && ack.cum + 1 + i < s->npkts; i++)
+    {
+        seq = ack.cum + 1 + i;
+        if (s->bits[(seq % MAXWINDOW) / 8] & (1 << (seq % 8)))
+        {
+            ack.sack[i / 64] |= 1ULL << (i % 64);
+            words = i / 64 + 1;
+        }
+    }
+    ack.len = words;
+    s->unacked = 0;
+    trace(TR_ACK_SENT, s->id, ack.cum, ACKHEADLEN + 8 * words);
+    send_ack(sockfd, &ack, ACKHEADLEN + 8 * words, &s->addr);
+}
+
+// Remember that s owes an ACK; it goes out once the socket is drained
+void ack_due(struct session_so *s)
+{
+    if (!s->due)
+    {
+        s->due = true;
+        s->due_next = due_list;
+        due_list = s;
+    }
+}
+
+bool is_hello(char *dgram, int n)
+{
+    return n == sizeof(struct hello_so) && ((struct hello_so *)dgram)->magic == HELLO_MAGIC;
+}
+
+// Hand out the next queued datagram without blocking; -1 with errno EAGAIN once the socket
+// is drained. *dgram points into a receive pool that stays valid until the next call; with -m
+// the pool is refilled by one recvmmsg that takes everything queued.
+int recv_pack(int sockfd, char **dgram, struct sockaddr_in *addr)
+{
+    static char *pool = NULL;
+    static struct sockaddr_in addrs[MMSG_MAX];
+    static struct iovec iovs[MMSG_MAX];
+    static struct mmsghdr msgs[MMSG_MAX];
+    static int count = 0, next = 0;   // datagrams returned by the last recvmmsg, and how many were consumed
+    socklen_t len = sizeof(struct sockaddr_in);
+    int i, n, slots;
+
+    if (pool == NULL)
+    {
+        pool = (char *) malloc(MMSG_POOL);
+        if (pool == NULL)
+        {
+            exit(2);
+        }
+    }
+
+    if (!use_mmsg)
+    {
+        n = recvfrom(sockfd, pool, WIREHEADLEN + CSUMLEN + MAXDATALEN, 0, (struct sockaddr *) addr, &len);
+        if (n != -1)
+        {
+            stats.recv_calls++;
+            stats.recv_pkts++;
+        }
+        *dgram = pool;
+        return n;
+    }
+
+    // Skip datagrams larger than any live session allows
+    while (next < count && (msgs[next].msg_hdr.msg_flags & MSG_TRUNC))
+    {
+        next++;
+    }
+    if (next == count)
+    {
+        slots = MMSG_POOL / rx_slot;
+        if (slots > MMSG_MAX)
+        {
+            slots = MMSG_MAX;
+        }
+        for (i = 0; i < slots; i++)
+        {
+            iovs[i].iov_base = pool + i * rx_slot;
+            iovs[i].iov_len = rx_slot;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        count = next = 0;
+        n = recvmmsg(sockfd, msgs, slots, MSG_DONTWAIT, NULL);
+        if (n == -1)
+        {
+            return -1;
+        }
+        stats.recv_calls++;
+        stats.recv_pkts += n;
+        count = n;
+        return recv_pack(sockfd, dgram, addr);
+    }
+
+    i = next++;
+    *dgram = iovs[i].iov_base;
+    *addr = addrs[i];
+    return msgs[i].msg_len;
+}
+
+void send_ack(int sockfd, void *ack, int size, struct sockaddr_in *addr)
+{
+    struct ur_ack_so *a;
+    struct io_uring_sqe *sqe;
+
+    if (use_uring)
+    {
+        // Goes out with the next io_uring_enter; with every ACK buffer in flight it is
+        // dropped, like an ACK that finds the socket buffer full
+        if (ur_nfree_acks == 0 || (sqe = uring_sqe(&ring)) == NULL)
+        {
+            return;
+        }
+        a = &ur_acks[ur_free_acks[--ur_nfree_acks]];
+        memcpy(&a->ack, ack, size);
+        a->addr = *addr;
+        a->iov.iov_base = &a->ack;
+        a->iov.iov_len = size;
+        memset(&a->msg, 0, sizeof(a->msg));
+        a->msg.msg_name = &a->addr;
+        a->msg.msg_namelen = sizeof(a->addr);
+        a->msg.msg_iov = &a->iov;
+        a->msg.msg_iovlen = 1;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (unsigned long)&a->msg;
+        sqe->len = 1;
+        sqe->user_data = (uint64_t)UR_ACK << 32 | (a - ur_acks);
+        stats.send_pkts++;
+        return;
+    }
+    if (!use_mmsg)
+    {
+        // A full socket buffer just loses this ACK; the client retransmits
+        if (sendto(sockfd, ack, size, 0, (struct sockaddr *)addr, sizeof(*addr)) == -1 && errno != EAGAIN)
+        {
+            printf("send ack error!\n");
+            exit(1);
+        }
+        stats.send_calls++;
+        stats.send_pkts++;
+        return;
+    }
+
+    memcpy(&ack_queue[ack_queued], ack, size);
+    ack_queue_len[ack_queued] = size;
+    ack_queue_addr[ack_queued] = *addr;
+    if (++ack_queued == MMSG_MAX)
+    {
+        flush_acks(sockfd);
+    }
+}
+
+// Send every ACK that is due: one per session with unacknowledged packets, then the queue
+void flush_acks(int sockfd)
+{
+    static struct iovec iovs[MMSG_MAX];
+    static struct mmsghdr msgs[MMSG_MAX];
+    struct session_so *s;
+    int i, n, sent;
+
+    while (due_list != NULL)
+    {
+        s = due_list;
+        due_list = s->due_next;
+        s->due = false;
+        if (s->unacked > 0)
+        {
+            send_sr_ack(sockfd, s);
+        }
+    }
+
+    for (i = 0; i < ack_queued; i++)
+    {
+        iovs[i].iov_base = &ack_queue[i];
+        iovs[i].iov_len = ack_queue_len[i];
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_name = &ack_queue_addr[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(ack_queue_addr[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (sent = 0; sent < ack_queued; sent += n)
+    {
+        n = sendmmsg(sockfd, msgs + sent, ack_queued - sent, 0);
+        if (n == -1)
+        {
+            if (errno == EAGAIN)
+            {
+                break;  // socket buffer full: the clients retransmit what these ACKs covered
+            }
+            printf("send ack error!\n");
+            exit(1);
+        }
+        stats.send_calls++;
+        stats.send_pkts += n;
+    }
+    ack_queued = 0;
+}
+
+long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+void print_syscalls(void)
+{
+    if (use_uring)
+    {
+        printf("io_uring_enter calls: %ld for %ld packets received, %ld file writes and %ld ACKs sent\n",
+               uring_enters, stats.recv_pkts, uring_writes, stats.send_pkts);
+    }
+    else
+    {
+        printf("Receive syscalls: %ld for %ld packets (%.2f per call), ACK syscalls: %ld for %ld ACKs (%.2f per call)\n",
+               stats.recv_calls, stats.recv_pkts, stats.recv_calls ? (float)stats.recv_pkts / stats.recv_calls : 0.0,
+               stats.send_calls, stats.send_pkts, stats.send_calls ? (float)stats.send_pkts / stats.send_calls : 0.0);
+    }
+    if (bad_csum > 0)
+    {
+        printf("Packets dropped for a bad checksum: %ld\n", bad_csum);
+    }
+    if (stats.misfits > 0 || stats.beyond_window > 0)
+    {
+        printf("Packets dropped outside the file: %ld, beyond the window: %ld\n", stats.misfits, stats.beyond_window);
+    }
+    if (fec_recovered > 0)
+    {
+        printf("DUs rebuilt from parity: %ld\n", fec_recovered);
+    }
+    if (zip_wire > 0)
+    {
+        printf("Decompressed: %ld file bytes from %ld (ratio %.2f)\n", zip_raw, zip_wire, (double)zip_raw / zip_wire);
+    }
+    if (bad_blocks > 0)
+    {
+        printf("Compressed blocks that did not decode: %ld\n", bad_blocks);
+    }
+    if (bad_hash > 0)
+    {
+        printf("Files that failed their CRC32C check: %ld\n", bad_hash);
+    }
+    if (checkpoints > 0)
+    {
+        printf("Checkpoints written: %ld\n", checkpoints);
+    }
+    if (print_stats)
+    {
+        stats_print(stdout);
+    }
+}
@@ -0,0 +1,190 @@
+// io_uring without liburing: ring setup, submission and completion queues, registration
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// One ring. The submission queue is filled with uring_sqe and handed to the kernel in one
+// io_uring_enter by uring_submit; completions are read with uring_cqe / uring_cqe_seen.
+struct uring_so
+{
+int fd;
+unsigned entries;			// submission queue size
+unsigned queued;			// SQEs filled in and not yet submitted
+unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+unsigned *cq_head, *cq_tail, *cq_mask;
+struct io_uring_sqe *sqes;
+struct io_uring_cqe *cqes;
+};
+
+// Set up a ring with room for entries submissions; -1 with errno set on failure
+static inline int uring_init(struct uring_so *r, unsigned entries)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+    size_t sq_len, cq_len;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+    r->entries = p.sq_entries;
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && cq_len > sq_len)
+        sq_len = cq_len;
+    sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+    cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return -1;
+    }
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        return -1;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+// Hand the queued SQEs to the kernel and wait until at least wait_nr completions are
+// ready, or timeout_us has passed (-1 = no limit). Returns -1 only on a real error.
+static inline int uring_submit(struct uring_so *r, unsigned wait_nr, long timeout_us)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    void *argp = NULL;
+    size_t argsz = 0;
+    int n;
+
+    if (wait_nr > 0 && timeout_us >= 0)
+    {
+        ts.tv_sec = timeout_us / 1000000;
+        ts.tv_nsec = timeout_us % 1000000 * 1000;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (unsigned long)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+    n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait_nr, flags, argp, argsz);
+    if (n < 0)
+        return (errno == ETIME || errno == EINTR) ? 0 : -1;
+    r->queued -= n;
+    return n;
+}
+
+// Next free SQE, cleared; when the queue is full the queued ones are submitted first
+static inline struct io_uring_sqe *uring_sqe(struct uring_so *r)
+{
+    unsigned tail = *r->sq_tail, idx;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries)
+    {
+        if (uring_submit(r, 0, -1) < 0)
+            return NULL;
+        if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries)
+            return NULL;
+    }
+    idx = tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+    return sqe;
+}
+
+// Oldest unread completion, or NULL
+static inline struct io_uring_cqe *uring_cqe(struct uring_so *r)
+{
+    unsigned head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring_so *r)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// One registered buffer (index 0) covering len bytes at base: *_FIXED operations on it
+// skip pinning and mapping the pages on every call
+static inline int uring_register_buffer(struct uring_so *r, void *base, size_t len)
+{
+    struct iovec iov;
+
+    iov.iov_base = base;
+    iov.iov_len = len;
+    return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, &iov, 1);
+}
+
+// A table of n fixed files; -1 entries are free slots for uring_set_file
+static inline int uring_register_files(struct uring_so *r, int *fds, unsigned n)
+{
+    return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES, fds, n);
+}
+
+// Put fd (or -1 to empty it) in slot index of the fixed file table
+static inline int uring_set_file(struct uring_so *r, unsigned index, int fd)
+{
+    struct io_uring_files_update up;
+
+    memset(&up, 0, sizeof(up));
+    up.offset = index;
+    up.fds = (unsigned long)&fd;
+    return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES_UPDATE, &up, 1);
+}
+
+// Cancel every request still in flight, drop the fixed files and close the ring. Ring
+// teardown in the kernel is asynchronous: without this a registered socket could stay open,
+// and its port bound, for a moment after the process is gone.
+static inline void uring_close(struct uring_so *r)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    bool cancelled = false;
+
+    sqe = uring_sqe(r);
+    if (sqe != NULL)
+    {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_ANY;
+        sqe->user_data = ~0ULL;
+        while (!cancelled && uring_submit(r, 1, -1) != -1)
+        {
+            while ((cqe = uring_cqe(r)) != NULL)
+            {
+                cancelled |= cqe->user_data == ~0ULL;
+                uring_cqe_seen(r);
+            }
+        }
+    }
+    syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_FILES, NULL, 0);
+    close(r->fd);
+}
+
+#endif
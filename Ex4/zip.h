@@ -0,0 +1,164 @@
+// Adaptive block compression for udp_client4 -Z. The file is cut into ZBLOCK byte blocks and
+// each goes on the wire as a zblock_so header and either its deflate stream or its raw bytes:
+// a block whose sampled byte entropy says it would hardly shrink is not even tried, and one
+// that did not shrink is sent raw, so incompressible data costs a histogram and 8 bytes a block.
+// The packets then carry this image of the file instead of the file.
+#ifndef ZIP_H
+#define ZIP_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define ZIP_SAMPLE 2048  // bytes of a block the entropy estimate looks at ...
+#define ZIP_RUNS 16  // ... in this many runs spread over the block, so few cache lines are touched
+#define ZIP_ENTROPY 7.0  // bits per byte above which a block is sent raw without trying
+#define ZIP_LEVEL 1  // zlib level: the fastest, the link is what we save on
+
+struct zip_so			//what compressing one file did
+{
+long raw, wire;				// file bytes, and bytes of the image that carries them
+long blocks;				// blocks in the file
+long skipped;				// of those, sent raw on the entropy estimate alone
+long packed;				// ... and sent deflated
+};
+
+static z_stream zip_deflate, zip_inflate;
+static bool zip_deflate_ready = false, zip_inflate_ready = false;
+static float zip_clogc[ZIP_SAMPLE + 1];  // c * log2(c), so the estimate needs no log2 per symbol
+
+// Order-0 entropy of ZIP_SAMPLE bytes of p (all of it if shorter), in bits per byte:
+// log2(N) - sum(c * log2(c)) / N over the byte counts c of the N bytes looked at
+static inline double zip_entropy(const unsigned char *p, long n)
+{
+    int count[256] = {0}, run = ZIP_SAMPLE / ZIP_RUNS, b;
+    long i, j, step, seen = 0;
+    double sum = 0;
+
+    if (zip_clogc[2] == 0)
+        for (i = 1; i <= ZIP_SAMPLE; i++)
+            zip_clogc[i] = i * log2(i);
+    if (n <= ZIP_SAMPLE)
+    {
+        run = n;
+        step = n;
+    }
+    else
+        step = n / ZIP_RUNS;
+    for (i = 0; i + run <= n && seen < ZIP_SAMPLE; i += step)
+        for (j = 0; j < run; j++, seen++)
+            count[p[i + j]]++;
+    if (seen == 0)
+        return 0;
+    for (b = 0; b < 256; b++)
+        sum += zip_clogc[count[b]];
+    return log2(seen) - sum / seen;
+}
+
+// Deflate n bytes into out; the compressed length, or -1 if it would not be shorter
+static inline long zip_pack(const char *in, long n, char *out)
+{
+    if (n < 2)
+        return -1;
+    if (!zip_deflate_ready)
+    {
+        if (deflateInit(&zip_deflate, ZIP_LEVEL) != Z_OK)
+            return -1;
+        zip_deflate_ready = true;
+    }
+    deflateReset(&zip_deflate);
+    zip_deflate.next_in = (unsigned char *)in;
+    zip_deflate.avail_in = n;
+    zip_deflate.next_out = (unsigned char *)out;
+    zip_deflate.avail_out = n - 1;
+    if (deflate(&zip_deflate, Z_FINISH) != Z_STREAM_END)
+        return -1;
+    return zip_deflate.total_out;
+}
+
+// Inflate n bytes into exactly raw bytes at out; 0, or -1 if they are not a deflate stream of that size
+static inline int zip_unpack(const char *in, long n, char *out, long raw)
+{
+    if (!zip_inflate_ready)
+    {
+        if (inflateInit(&zip_inflate) != Z_OK)
+            return -1;
+        zip_inflate_ready = true;
+    }
+    inflateReset(&zip_inflate);
+    zip_inflate.next_in = (unsigned char *)in;
+    zip_inflate.avail_in = n;
+    zip_inflate.next_out = (unsigned char *)out;
+    zip_inflate.avail_out = raw;
+    if (inflate(&zip_inflate, Z_FINISH) != Z_STREAM_END || zip_inflate.total_out != (unsigned long)raw)
+        return -1;
+    return 0;
+}
+
+// How many of the blocks of n bytes at buf are worth trying to deflate; skip[b] records whether
+// block b is not, for zip_image. If none is, the file is better sent as it is, without copying
+// it into an image: z then describes that.
+static inline long zip_survey(const char *buf, long n, struct zip_so *z, bool *skip)
+{
+    long off, len;
+
+    memset(z, 0, sizeof(*z));
+    z->raw = z->wire = n;
+    for (off = 0; off < n; off += len, z->blocks++)
+    {
+        len = n - off < ZBLOCK ? n - off : ZBLOCK;
+        skip[z->blocks] = zip_entropy((const unsigned char *)buf + off, len) > ZIP_ENTROPY;
+        if (skip[z->blocks])
+            z->skipped++;
+    }
+    return z->blocks - z->skipped;
+}
+
+// The wire image of n bytes at buf, malloc'd, with the blocks zip_survey marked in skip sent raw;
+// its size goes to z->wire. NULL if out of memory.
+static inline char *zip_image(const char *buf, long n, struct zip_so *z, const bool *skip)
+{
+    struct zblock_so head;
+    long off, len, packed, b;
+    char *image, *p;
+
+    memset(z, 0, sizeof(*z));
+    z->raw = n;
+    z->blocks = (n + ZBLOCK - 1) / ZBLOCK;
+    // The worst case is every block raw
+    image = malloc(n + z->blocks * ZHEADLEN + 1);
+    if (image == NULL)
+        return NULL;
+    p = image;
+    for (off = 0, b = 0; off < n; off += len, b++)
+    {
+        len = n - off < ZBLOCK ? n - off : ZBLOCK;
+        packed = -1;
+        if (skip[b])
+            z->skipped++;
+        else
+            packed = zip_pack(buf + off, len, p + ZHEADLEN);
+        memset(&head, 0, sizeof(head));
+        if (packed > 0)
+        {
+            head.method = ZIP_DEFLATE;
+            head.len = packed;
+            z->packed++;
+        }
+        else
+        {
+            head.method = ZIP_RAW;
+            head.len = len;
+            memcpy(p + ZHEADLEN, buf + off, len);
+        }
+        memcpy(p, &head, ZHEADLEN);
+        p += ZHEADLEN + head.len;
+    }
+    z->wire = p - image;
+    return image;
+}
+
+#endif